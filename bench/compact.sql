@@ -0,0 +1,80 @@
+/* contrib/pg_intercept_server_logs/bench/compact.sql */
+
+-- Per-message cost and size of the text and compact log formats, for an
+-- ERROR-like message with DETAIL, HINT, CONTEXT, LOCATION and STATEMENT
+-- lines.  Run it as a superuser with pg_intercept_server_logs.log_directory
+-- set and without ring_buffer_size or retention, so that what's written is
+-- in the files by the time the size is taken; the module needn't be in
+-- shared_preload_libraries:
+--
+--   psql -X -f bench/compact.sql
+--   psql -X -v messages=1000000 -f bench/compact.sql
+--
+-- Each run raises the given number of NOTICEs from PL/pgSQL and reports the
+-- time and the bytes written per message.  Bytes are counted over the
+-- NOTICE*.log files, lc_messages being C or English.
+
+\if :{?messages}
+\else
+\set messages 100000
+\endif
+
+LOAD 'pg_intercept_server_logs';
+
+SELECT current_setting('pg_intercept_server_logs.log_directory') <> ''
+    AS have_log_directory \gset
+\if :have_log_directory
+\else
+\echo pg_intercept_server_logs.log_directory must be set
+\quit
+\endif
+
+\timing on
+
+SET client_min_messages = warning;
+SET pg_intercept_server_logs.override_log_min_messages = on;
+SET pg_intercept_server_logs.log_level = notice;
+SET pg_intercept_server_logs.fields = all;
+SET pg_intercept_server_logs.buffer_size = '64kB';
+
+CREATE FUNCTION pg_temp.raise_messages(n int) RETURNS text
+LANGUAGE plpgsql AS $$
+DECLARE
+    started timestamptz := clock_timestamp();
+BEGIN
+    FOR i IN 1..n LOOP
+        RAISE NOTICE 'duplicate key value violates unique constraint "orders_pkey"'
+            USING DETAIL = format('Key (id)=(%s) already exists.', i),
+                  HINT = 'Retry the transaction with another key.';
+    END LOOP;
+    RETURN round(extract(epoch FROM clock_timestamp() - started) * 1e9 / n) ||
+        ' ns/message';
+END
+$$;
+
+CREATE FUNCTION pg_temp.log_size() RETURNS bigint
+LANGUAGE sql AS $$
+    SELECT coalesce(sum((pg_stat_file(d || '/' || f, true)).size), 0)::bigint
+    FROM (SELECT current_setting('pg_intercept_server_logs.log_directory') AS d) s,
+         pg_ls_dir(d, true, false) f
+    WHERE f LIKE 'NOTICE%.log'
+$$;
+
+-- Warm up, the first messages pay for loading PL/pgSQL and the like.
+SELECT pg_temp.raise_messages(:messages / 10) AS warm_up;
+
+SET pg_intercept_server_logs.log_format = text;
+SELECT pg_temp.log_size() AS size_before \gset
+SELECT 'text' AS run, pg_temp.raise_messages(:messages);
+SELECT 'text' AS run,
+    (pg_temp.log_size() - :size_before) / :messages AS bytes_per_message;
+
+SET pg_intercept_server_logs.log_format = compact;
+SELECT pg_temp.log_size() AS size_before \gset
+SELECT 'compact' AS run, pg_temp.raise_messages(:messages);
+SELECT 'compact' AS run,
+    (pg_temp.log_size() - :size_before) / :messages AS bytes_per_message;
+
+RESET pg_intercept_server_logs.log_format;
+RESET pg_intercept_server_logs.fields;
+RESET pg_intercept_server_logs.buffer_size;
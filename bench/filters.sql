@@ -0,0 +1,101 @@
+/* contrib/pg_intercept_server_logs/bench/filters.sql */
+
+-- Per-message cost of pg_intercept_server_logs.include_patterns at 1, 10 and
+-- 100 patterns, substrings and regular expressions, and of writing the
+-- messages out as per pg_intercept_server_logs.buffer_size.  Run it as a
+-- superuser, the module needn't be in shared_preload_libraries:
+--
+--   psql -X -f bench/filters.sql
+--   psql -X -v messages=1000000 -f bench/filters.sql
+--
+-- Each run raises the given number of NOTICEs from PL/pgSQL and reports the
+-- time per message.  None of the patterns match, so the messages are dropped
+-- right after matching.  The baseline has them dropped by include_sqlstates
+-- instead, before the patterns are looked at: the difference is what the
+-- patterns cost.  The runs that write the messages need
+-- pg_intercept_server_logs.log_directory to be set; start the server with
+-- pg_intercept_server_logs.ring_buffer_size and deferred_formatting set to
+-- compare those too.
+
+\if :{?messages}
+\else
+\set messages 100000
+\endif
+
+\timing on
+
+LOAD 'pg_intercept_server_logs';
+
+SET client_min_messages = warning;
+SET pg_intercept_server_logs.override_log_min_messages = on;
+SET pg_intercept_server_logs.log_level = notice;
+
+CREATE FUNCTION pg_temp.raise_messages(n int) RETURNS text
+LANGUAGE plpgsql AS $$
+DECLARE
+    started timestamptz := clock_timestamp();
+BEGIN
+    FOR i IN 1..n LOOP
+        RAISE NOTICE 'benchmark message % of %, checkpoint starting: time', i, n;
+    END LOOP;
+    RETURN round(extract(epoch FROM clock_timestamp() - started) * 1e9 / n) ||
+        ' ns/message';
+END
+$$;
+
+SELECT string_agg('no such text ' || i, ', ') AS substrings_1
+FROM generate_series(1, 1) i \gset
+SELECT string_agg('no such text ' || i, ', ') AS substrings_10
+FROM generate_series(1, 10) i \gset
+SELECT string_agg('no such text ' || i, ', ') AS substrings_100
+FROM generate_series(1, 100) i \gset
+SELECT string_agg('/nomatch' || i || ' [0-9]+/', ', ') AS regexes_1
+FROM generate_series(1, 1) i \gset
+SELECT string_agg('/nomatch' || i || ' [0-9]+/', ', ') AS regexes_10
+FROM generate_series(1, 10) i \gset
+SELECT string_agg('/nomatch' || i || ' [0-9]+/', ', ') AS regexes_100
+FROM generate_series(1, 100) i \gset
+
+-- Warm up, the first messages pay for loading PL/pgSQL and the like.
+SET pg_intercept_server_logs.include_sqlstates = 'XX000';
+SELECT pg_temp.raise_messages(:messages / 10) AS warm_up;
+
+SELECT 'baseline' AS run, pg_temp.raise_messages(:messages);
+RESET pg_intercept_server_logs.include_sqlstates;
+
+SET pg_intercept_server_logs.include_patterns = :'substrings_1';
+SELECT '1 substring' AS run, pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.include_patterns = :'substrings_10';
+SELECT '10 substrings' AS run, pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.include_patterns = :'substrings_100';
+SELECT '100 substrings' AS run, pg_temp.raise_messages(:messages);
+
+SET pg_intercept_server_logs.include_patterns = :'regexes_1';
+SELECT '1 regex' AS run, pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.include_patterns = :'regexes_10';
+SELECT '10 regexes' AS run, pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.include_patterns = :'regexes_100';
+SELECT '100 regexes' AS run, pg_temp.raise_messages(:messages);
+
+RESET pg_intercept_server_logs.include_patterns;
+
+SELECT current_setting('pg_intercept_server_logs.log_directory') <> ''
+    AS have_log_directory \gset
+\if :have_log_directory
+SET pg_intercept_server_logs.buffer_size = 0;
+SELECT 'written, unbuffered' AS run, pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.buffer_size = '64kB';
+SELECT 'written, 64kB buffer' AS run, pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.exclude_patterns = 'nomatch';
+SET pg_intercept_server_logs.include_patterns = 'benchmark';
+SELECT 'written, 64kB buffer, 1 + 1 substrings' AS run,
+    pg_temp.raise_messages(:messages);
+SET pg_intercept_server_logs.exclude_patterns = :'substrings_100';
+SELECT 'written, 64kB buffer, 1 + 100 substrings' AS run,
+    pg_temp.raise_messages(:messages);
+RESET pg_intercept_server_logs.include_patterns;
+RESET pg_intercept_server_logs.exclude_patterns;
+RESET pg_intercept_server_logs.buffer_size;
+\else
+\echo pg_intercept_server_logs.log_directory is not set, skipping the runs that write the messages out
+\endif
@@ -0,0 +1,89 @@
+/* contrib/pg_intercept_server_logs/bench/long_fields.sql */
+
+-- Per-message cost of formatting long multi-line fields, which go through
+-- append_with_tabs() to get a tab after each newline: a 4kB DETAIL of 80
+-- byte lines, the same without newlines, and a 4kB statement.  Run it as a
+-- superuser with pg_intercept_server_logs.log_directory set, the module
+-- needn't be in shared_preload_libraries:
+--
+--   psql -X -f bench/long_fields.sql
+--   psql -X -v messages=1000000 -f bench/long_fields.sql
+--
+-- Each run raises the given number of NOTICEs from PL/pgSQL, writes them out
+-- in text format and reports the time per message.  The baseline writes the
+-- message alone: the difference is what the long fields cost.
+--
+-- To compare append_with_tabs() copying the newline-free runs in bulk with
+-- the loop over each character it replaced, run the script against both
+-- builds; as the module is loaded per session, a new psql picks up the
+-- library just installed:
+--
+--   git checkout "$(git log --format=%h -1 --grep='Copy newline-free runs')^"
+--   make USE_PGXS=1 install
+--   psql -X -v messages=1000000 -f bench/long_fields.sql > per_character.out
+--   git checkout -
+--   make USE_PGXS=1 install
+--   psql -X -v messages=1000000 -f bench/long_fields.sql > bulk.out
+--
+-- The single line DETAIL shows the copy alone, the 80 byte lines add the
+-- cost of a tab every 80 bytes.
+
+\if :{?messages}
+\else
+\set messages 100000
+\endif
+
+LOAD 'pg_intercept_server_logs';
+
+SELECT current_setting('pg_intercept_server_logs.log_directory') <> ''
+    AS have_log_directory \gset
+\if :have_log_directory
+\else
+\echo pg_intercept_server_logs.log_directory must be set
+\quit
+\endif
+
+\timing on
+
+SET client_min_messages = warning;
+SET pg_intercept_server_logs.override_log_min_messages = on;
+SET pg_intercept_server_logs.log_level = notice;
+SET pg_intercept_server_logs.log_format = text;
+SET pg_intercept_server_logs.buffer_size = '64kB';
+
+CREATE FUNCTION pg_temp.raise_messages(n int, detail_text text) RETURNS text
+LANGUAGE plpgsql AS $$
+DECLARE
+    started timestamptz := clock_timestamp();
+BEGIN
+    FOR i IN 1..n LOOP
+        RAISE NOTICE 'benchmark message % of %', i, n USING DETAIL = detail_text;
+    END LOOP;
+    RETURN round(extract(epoch FROM clock_timestamp() - started) * 1e9 / n) ||
+        ' ns/message';
+END
+$$;
+
+SELECT string_agg(repeat('x', 79), E'\n') AS lines
+FROM generate_series(1, 52) \gset
+SELECT repeat('x', 4160) AS no_lines \gset
+
+-- Warm up, the first messages pay for loading PL/pgSQL and the like.
+SET pg_intercept_server_logs.fields = message;
+SELECT pg_temp.raise_messages(:messages / 10, '') AS warm_up;
+
+SELECT 'baseline' AS run, pg_temp.raise_messages(:messages, '');
+
+SET pg_intercept_server_logs.fields = 'message, detail';
+SELECT '4kB detail, 80 byte lines' AS run,
+    pg_temp.raise_messages(:messages, :'lines');
+SELECT '4kB detail, single line' AS run,
+    pg_temp.raise_messages(:messages, :'no_lines');
+
+-- The statement is the whole query, comment included.
+SET pg_intercept_server_logs.fields = 'message, statement';
+SELECT format('SELECT %L AS run, pg_temp.raise_messages(%s, %L) /* %s */',
+              '4kB statement', :messages, '', :'lines') \gexec
+
+RESET pg_intercept_server_logs.fields;
+RESET pg_intercept_server_logs.buffer_size;
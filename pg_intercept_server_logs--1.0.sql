@@ -0,0 +1,39 @@
+/* contrib/pg_intercept_server_logs/pg_intercept_server_logs--1.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION pg_intercept_server_logs" to load this file. \quit
+
+-- Renders the records of a binary intercept log file in another format
+CREATE FUNCTION pg_intercept_server_logs_decode(path text,
+    format text DEFAULT 'text')
+RETURNS SETOF text
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+-- Reads arbitrary files, don't let just anyone use it
+REVOKE ALL ON FUNCTION pg_intercept_server_logs_decode(text, text) FROM PUBLIC;
+
+-- Starts new intercept log files right away
+CREATE FUNCTION pg_intercept_server_logs_rotate()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_intercept_server_logs_rotate() FROM PUBLIC;
+
+-- Reports the module's counters
+CREATE FUNCTION pg_intercept_server_logs_stats(
+    OUT ring_overflows bigint,
+    OUT dropped_bytes bigint,
+    OUT disk_full boolean,
+    OUT removed_files bigint,
+    OUT removed_bytes bigint,
+    OUT write_failures bigint,
+    OUT last_error text,
+    OUT last_failure timestamptz,
+    OUT suppressed_messages bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_intercept_server_logs_stats() FROM PUBLIC;
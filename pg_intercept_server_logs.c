@@ -14,44 +14,962 @@
 #include <limits.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "access/xact.h"
+#include "catalog/pg_collation.h"
+#include "catalog/pg_type.h"
 #include "common/file_perm.h"
+#include "common/hashfn.h"
+#include "funcapi.h"
 #include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
+#include "libpq/libpq-be.h"
 #include "miscadmin.h"
+#include "parser/scansup.h"
+#include "pgstat.h"
 #include "pgtime.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "regex/regex.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
 #include "tcop/tcopprot.h"
+#include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/guc_tables.h"
+#include "utils/hsearch.h"
+#include "utils/backend_status.h"
+#include "utils/memutils.h"
+#include "utils/ps_status.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include "utils/varlena.h"
 
 PG_MODULE_MAGIC;
 
 void		_PG_init(void);
 void		_PG_fini(void);
+PGDLLEXPORT void pg_intercept_server_logs_writer_main(Datum main_arg);
+PGDLLEXPORT void pg_intercept_server_logs_retention_main(Datum main_arg);
+
+PG_FUNCTION_INFO_V1(pg_intercept_server_logs_decode);
+PG_FUNCTION_INFO_V1(pg_intercept_server_logs_rotate);
+PG_FUNCTION_INFO_V1(pg_intercept_server_logs_stats);
 
 #define LOG_LEVEL_NONE 255
 #define FORMATTED_TS_LEN 128
 
+/* Bit of elevel in the mask of levels to intercept. */
+#define INTERCEPT_LEVEL_BIT(elevel) (((uint32) 1) << (elevel))
+
+/*
+ * GUC check hooks allocate their extra with malloc, or with guc_malloc since
+ * v16.
+ */
+#if PG_VERSION_NUM >= 160000
+#define intercept_guc_malloc(size) guc_malloc(LOG, (size))
+#else
+#define intercept_guc_malloc(size) malloc(size)
+#endif
+
+/* Formats of the intercepted messages. */
+typedef enum InterceptLogFormat
+{
+	INTERCEPT_FORMAT_TEXT,
+	INTERCEPT_FORMAT_COMPACT,
+	INTERCEPT_FORMAT_JSON,
+	INTERCEPT_FORMAT_CSV,
+	INTERCEPT_FORMAT_BINARY
+} InterceptLogFormat;
+
+/* What to do with the messages that couldn't be written out. */
+typedef enum InterceptFailurePolicy
+{
+	INTERCEPT_FAILURE_DROP,
+	INTERCEPT_FAILURE_RETRY,
+	INTERCEPT_FAILURE_STDERR
+} InterceptFailurePolicy;
+
+/*
+ * Everything that goes into the formatted message, gathered once per message
+ * so that all the formats render the same data.
+ */
+typedef struct InterceptLogRecord
+{
+	/* When and by whom */
+	struct timeval log_time;
+	char		formatted_log_time[FORMATTED_TS_LEN];
+	int			pid;
+	const char *user_name;
+	const char *database_name;
+	const char *application_name;
+	const char *backend_type;
+	const char *remote_host;
+	const char *remote_port;
+	bool		session_process;	/* has a client connection? */
+	pg_time_t	session_start;
+	long		session_line_num;	/* counts intercepted messages */
+	const char *command_tag;	/* ps display, not NUL-terminated */
+	int			command_tag_len;
+	int			vxid_backend_id;	/* -1 if no virtual transaction id */
+	uint32		vxid_local_xid;
+	TransactionId xid;
+	int			leader_pid;		/* 0 if not a parallel worker */
+	int64		query_id;
+
+	/* The message, as per ErrorData */
+	int			elevel;
+	int			sqlerrcode;
+	const char *message;		/* NULL only if not in fields */
+	const char *detail;			/* detail_log if any, else detail */
+	const char *hint;
+	const char *internalquery;
+	int			internalpos;
+	const char *context;		/* NULL if hide_ctx */
+	int			cursorpos;
+	const char *funcname;
+	const char *filename;
+	int			lineno;
+	const char *backtrace;
+	const char *statement;		/* debug_query_string */
+	int			statement_len;	/* at most max_statement_length */
+	bool		statement_truncated;
+	uint32		statement_id;	/* 0 unless deduplicate_statements */
+	bool		statement_repeated; /* already written with statement_id? */
+
+	bool		decoded;		/* from a binary record, see get_prefix_constants */
+} InterceptLogRecord;
+
+/*
+ * An operation of the compiled line_prefix: either a run of literal text or
+ * one of the log_line_prefix escapes.
+ */
+typedef struct InterceptPrefixOp
+{
+	char		escape;			/* escape letter, or '\0' for literal text */
+	int			padding;		/* as in log_line_prefix, 0 for none */
+	int			offset;			/* of the literal text in text[] */
+	int			len;			/* of the literal text */
+} InterceptPrefixOp;
+
+/*
+ * line_prefix compiled by its check hook.  It's the GUC's extra, hence a
+ * single chunk: the literal text follows the ops.
+ */
+typedef struct InterceptPrefix
+{
+	int			nops;
+	InterceptPrefixOp ops[FLEXIBLE_ARRAY_MEMBER];
+} InterceptPrefix;
+
+#define INTERCEPT_PREFIX_TEXT(prefix) \
+	((const char *) &(prefix)->ops[(prefix)->nops])
+
+/*
+ * include_patterns or exclude_patterns compiled by its check hook, the GUC's
+ * extra, hence a single chunk.
+ *
+ * The literal patterns make up an Aho-Corasick automaton, turned into a DFA
+ * so that matching takes one table lookup per byte of the message, whatever
+ * the number of patterns: next[] has nclasses entries per state, bytes being
+ * mapped to their class by classes[] to keep the table small.  State 0 is the
+ * root, accept[] follows next[] and tells the states where a pattern ends.
+ * The sources of the /regex/ patterns follow, NUL-terminated, to be compiled
+ * by the assign hook.
+ */
+typedef struct InterceptPatterns
+{
+	int			nstates;		/* 0 if there are no literal patterns */
+	int			nclasses;
+	int			nregexes;
+	int			regexes_offset; /* of the first regex source in next[] */
+	uint8		classes[256];
+	int32		next[FLEXIBLE_ARRAY_MEMBER];
+} InterceptPatterns;
+
+#define INTERCEPT_PATTERNS_ACCEPT(patterns) \
+	((const bool *) &(patterns)->next[(patterns)->nstates * (patterns)->nclasses])
+#define INTERCEPT_PATTERNS_REGEXES(patterns) \
+	((const char *) (patterns)->next + (patterns)->regexes_offset)
+
+/*
+ * A set of patterns along with its regexes, compiled by the assign hook.  A
+ * regex that couldn't be compiled for lack of memory never matches.
+ */
+typedef struct InterceptFilter
+{
+	InterceptPatterns *patterns;	/* NULL if there are no patterns */
+	regex_t    *regexes;
+	bool	   *compiled;
+} InterceptFilter;
+
+/*
+ * Messages shorter than this many characters are matched against the regexes
+ * in a buffer kept around, longer ones in a buffer of their own.
+ */
+#define INTERCEPT_FILTER_WIDE_SIZE 1024
+
+/*
+ * include_sqlstates or exclude_sqlstates compiled by its check hook, the
+ * GUC's extra.  Classes are a bitmap indexed by ERRCODE_TO_CATEGORY, codes an
+ * open-addressing hash set of packed SQLSTATEs, linearly probed.
+ */
+typedef struct InterceptSqlstates
+{
+	uint64		classes[(1 << 12) / 64];
+	uint32		mask;			/* of codes[], whose size is a power of 2 */
+	uint32		codes[FLEXIBLE_ARRAY_MEMBER];
+} InterceptSqlstates;
+
+/* Free slot of InterceptSqlstates.codes, packed SQLSTATEs using 30 bits */
+#define INTERCEPT_SQLSTATE_EMPTY PG_UINT32_MAX
+
+/*
+ * backend_types, databases, roles or application_names compiled by its check
+ * hook, the GUC's extra.  names has nnames entries, NUL-terminated one after
+ * the other, each starting with '+' if it's to be included or '-' if it's to
+ * be excluded.
+ */
+typedef struct InterceptNameList
+{
+	int			nnames;
+	bool		has_includes;
+	char		names[FLEXIBLE_ARRAY_MEMBER];
+} InterceptNameList;
+
+/*
+ * Whether this process's messages pass backend_types, databases, roles and
+ * application_names, as of the identity it was computed for.  Any of those
+ * settings changing resets pid.
+ */
+typedef struct InterceptProcessVerdict
+{
+	int			pid;
+	Oid			database_id;
+	Oid			role_id;
+	const char *database_name;	/* MyProcPort's, set along with its user */
+	const char *application_name;	/* see intercept_process_wanted */
+	char		application_name_copy[NAMEDATALEN];
+	bool		wanted;
+} InterceptProcessVerdict;
+
+/* Role this process authenticated as, if it has connected to a database */
+#define INTERCEPT_MY_ROLE_ID() (MyProc ? MyProc->roleId : InvalidOid)
+
+/*
+ * Verdict of locations on the messages from a function of a file, cached by
+ * the addresses of the names: those come from __func__ and __FILE__, so stay
+ * put and are shared by all the messages from the same place.
+ */
+typedef struct InterceptLocationKey
+{
+	const char *funcname;
+	const char *filename;
+} InterceptLocationKey;
+
+/* Cap on the locations whose verdict is cached */
+#define INTERCEPT_LOCATION_CACHE_SIZE 4096
+
+typedef struct InterceptLocationEntry
+{
+	InterceptLocationKey key;	/* hash key */
+	bool		wanted;
+} InterceptLocationEntry;
+
+/*
+ * Parts of the prefix that stay the same for all the messages of a backend,
+ * rendered once.
+ */
+typedef struct InterceptPrefixConstants
+{
+	int			pid;
+	const char *user_name;
+	const char *database_name;
+	const char *backend_type;
+	char		pid_str[12];
+	int			pid_len;
+	int			user_name_len;
+	int			database_name_len;
+	int			backend_type_len;
+} InterceptPrefixConstants;
+
+/* Number of slots in the intercept log file cache, one per elevel. */
+#define INTERCEPT_NUM_SLOTS (PANIC + 1)
+
+/*
+ * An entry of the per-backend intercept log file cache.
+ */
+typedef struct InterceptLogFile
+{
+	int			fd;				/* open descriptor, or -1 if not open */
+	bool		external_fd;	/* fd accounted via AcquireExternalFD? */
+	bool		inherited;		/* opened by the postmaster, not yet used? */
+	uint64		segment_start;	/* segment fd is open on, see
+								 * get_intercept_log_segment */
+
+	/* Write-combining buffer, used when buffer_size is set */
+	char	   *buffer;
+	int			buffer_size;	/* allocated size of buffer */
+	int			buffer_len;		/* bytes currently buffered */
+	TimestampTz buffer_start;	/* when the first buffered line came in */
+
+	/*
+	 * With on_write_failure = retry, the file isn't written to before
+	 * retry_at, retry_delay after the last failure.  0 if it didn't fail.
+	 */
+	int			retry_delay;
+	TimestampTz retry_at;
+
+	/* Failure reported by the writer, until the file is written to again */
+	bool		failure_reported;
+
+	/* Statement last written in full, as per deduplicate_statements */
+	uint32		statement_id;
+
+	/*
+	 * Bumped whenever the file is closed or rotated, or data meant for it is
+	 * discarded, see intern_intercept_string
+	 */
+	uint32		generation;
+	uint64		formatted_segment_start;	/* segment formatted for */
+	uint32		formatted_losses;	/* segment_losses formatted for */
+} InterceptLogFile;
+
+/*
+ * Units of the binary format.  Each unit is a four-byte little-endian length
+ * followed by that many bytes, the first of which is the unit type.
+ */
+#define INTERCEPT_BINARY_DEFINITION	'D' /* pid, id, then the string */
+#define INTERCEPT_BINARY_RECORD		'R' /* see format_binary_intercept_log_record */
+#define INTERCEPT_BINARY_INLINE_RECORD	'I' /* same, no interned strings */
+
+/* Flags of a record unit */
+#define INTERCEPT_BINARY_SESSION_PROCESS	0x01
+#define INTERCEPT_BINARY_STATEMENT_TRUNCATED 0x02
+#define INTERCEPT_BINARY_STATEMENT_REPEATED	0x04
+
+/* Signed integers go into varints zigzag-encoded, so that small ones are short. */
+#define ZIGZAG(v)	((((uint64) (v)) << 1) ^ (uint64) (((int64) (v)) >> 63))
+#define UNZIGZAG(v)	((int64) (((v) >> 1) ^ (~((v) & 1) + 1)))
+
+/*
+ * A string interned into the binary intercept log files, keyed by its address.
+ */
+/* Cap on the strings interned by a backend, see intern_intercept_string */
+#define INTERCEPT_INTERN_MAX_STRINGS 4096
+
+typedef struct InterceptInternEntry
+{
+	const char *str;			/* hash key */
+	uint32		id;
+	uint32		generation[INTERCEPT_NUM_SLOTS];	/* of the file of each slot
+													 * it was defined in */
+} InterceptInternEntry;
+
+/*
+ * A string interned by a backend, as read by pg_intercept_server_logs_decode.
+ */
+typedef struct InterceptDecodedKey
+{
+	int			pid;
+	uint32		id;
+} InterceptDecodedKey;
+
+typedef struct InterceptDecodedString
+{
+	InterceptDecodedKey key;	/* hash key */
+	char	   *str;
+} InterceptDecodedString;
+
+/*
+ * Header of a line in the shared ring buffer.  The line itself follows the
+ * header, the whole record being padded to MAXALIGN so that a header never
+ * wraps around the end of the ring.
+ */
+typedef struct InterceptRingRecord
+{
+	uint32		len;			/* length of the line */
+	uint8		elevel;			/* elevel of the line */
+	bool		deferred;		/* an inline record for the writer to format? */
+	volatile uint16 committed;	/* set once the line is copied in */
+} InterceptRingRecord;
+
+#define INTERCEPT_RING_RECORD_SIZE(len) \
+	MAXALIGN(sizeof(InterceptRingRecord) + (len))
+
+/*
+ * Size of the table of rate_limit buckets, how many of them a template may
+ * go into, and after how many seconds of not being used one may be taken
+ * over by another template.
+ */
+#define INTERCEPT_RATE_BUCKETS 1024
+#define INTERCEPT_RATE_PROBES 8
+#define INTERCEPT_RATE_IDLE 60
+
+/*
+ * Token bucket of a message template, as per rate_limit.  Templates are
+ * hashed into a fixed-size table in shared memory, probed linearly over a few
+ * buckets.  Where the template was raised from is kept for the summary of its
+ * suppressed messages, which may be written by another process, see
+ * flush_intercept_suppressed_summaries.
+ */
+typedef struct InterceptRateBucket
+{
+	pg_atomic_uint64 key;		/* template's hash, 0 if the bucket is free */
+	slock_t		mutex;			/* protects the rest, and setting key */
+	double		tokens;
+	TimestampTz last_refill;	/* set along with key */
+	uint64		suppressed;		/* since the last message let through */
+	int			elevel;			/* of the last message suppressed */
+	int			sqlerrcode;		/* likewise */
+	int			lineno;
+	char		filename[NAMEDATALEN];
+} InterceptRateBucket;
+
+/*
+ * Shared state, exists only when the module is loaded via
+ * shared_preload_libraries.
+ *
+ * Backends reserve space in the ring by advancing insert_pos with a
+ * compare-and-swap, copy their line in and then mark the record committed.
+ * The writer process consumes committed records in order, zeroes out the
+ * space they took and then advances read_pos to hand the space back, so a
+ * freshly reserved record always starts out uncommitted.
+ *
+ * Backends count themselves in inserters before making sure that the writer
+ * is still running, and out once their record is committed.  The writer,
+ * once it has stopped running, waits for inserters to drop to 0 before its
+ * final drain, so that no record is left behind in the ring.
+ */
+typedef struct InterceptSharedState
+{
+	/*
+	 * mutex protects writer_running, writer_latch, log_directory and
+	 * log_format.  Backends peek at the first two without it, being off by one
+	 * line doesn't hurt.
+	 */
+	slock_t		mutex;
+	bool		writer_running;
+	Latch	   *writer_latch;
+	char		log_directory[MAXPGPATH];	/* writer's log_directory */
+	int			log_format;		/* writer's log_format */
+
+	/* bumped whenever the writer's log_directory or log_format changes */
+	pg_atomic_uint32 destination_generation;
+
+	/* lines that didn't fit into the ring and were written by backends */
+	pg_atomic_uint64 ring_overflows;
+
+	/*
+	 * Current segment of the intercept log file of each slot, as per
+	 * INTERCEPT_SEGMENT_SEQ_BITS, 0 if it hasn't been rotated, and the bytes
+	 * written into it so far.  Rotating is bumping the segment, processes
+	 * notice on their next write and reopen.
+	 */
+	pg_atomic_uint64 segment_start[INTERCEPT_NUM_SLOTS];
+	pg_atomic_uint64 segment_bytes[INTERCEPT_NUM_SLOTS];
+
+	/*
+	 * Bumped whenever the writer discards lines meant for the file of each
+	 * slot.  Those may have carried the backends' string definitions and
+	 * statements, which they then write again.
+	 */
+	pg_atomic_uint32 segment_losses[INTERCEPT_NUM_SLOTS];
+
+	/*
+	 * Until when messages are dropped for lack of disk space, 0 if they
+	 * aren't, and the bytes dropped so far.
+	 */
+	pg_atomic_uint64 disk_full_until;
+	pg_atomic_uint64 dropped_bytes;
+
+	/* sealed segments removed by the retention worker */
+	pg_atomic_uint64 removed_files;
+	pg_atomic_uint64 removed_bytes;
+
+	/* failures to open or write the files, and the last one's errno and time */
+	pg_atomic_uint64 write_failures;
+	pg_atomic_uint32 last_errno;
+	pg_atomic_uint64 last_failure_time;
+
+	/* messages suppressed by rate_limit, and its buckets */
+	pg_atomic_uint64 suppressed_messages;
+	InterceptRateBucket rate_buckets[INTERCEPT_RATE_BUCKETS];
+
+	Size		ring_size;
+	pg_atomic_uint32 inserters;
+	pg_atomic_uint64 insert_pos;
+	pg_atomic_uint64 read_pos;
+	char		ring[FLEXIBLE_ARRAY_MEMBER];
+} InterceptSharedState;
+
+/*
+ * Fields of the intercepted messages that can be left out as per the fields
+ * GUC.
+ */
+#define INTERCEPT_FIELD_MESSAGE		0x01
+#define INTERCEPT_FIELD_DETAIL		0x02
+#define INTERCEPT_FIELD_HINT		0x04
+#define INTERCEPT_FIELD_QUERY		0x08
+#define INTERCEPT_FIELD_CONTEXT		0x10
+#define INTERCEPT_FIELD_LOCATION	0x20
+#define INTERCEPT_FIELD_BACKTRACE	0x40
+#define INTERCEPT_FIELD_STATEMENT	0x80
+#define INTERCEPT_FIELD_ALL			0xFF
+
+/* Appended to a statement cut at max_statement_length, as for parameters. */
+#define INTERCEPT_TRUNCATION_MARKER "..."
+
+/* Smallest size of the buffer messages are formatted in. */
+#define INTERCEPT_FORMAT_BUFFER_MIN_SIZE 1024
+
+/* Size of the buffers the writer process collects lines in. */
+#define INTERCEPT_WRITER_BUFFER_SIZE (64 * 1024)
+
+/* How long the writer process sleeps if it isn't woken up. */
+#define INTERCEPT_WRITER_NAPTIME 1000
+
+/* How often the retention worker looks at log_directory. */
+#define INTERCEPT_RETENTION_NAPTIME 10000
+
+/* How long, in seconds, messages are dropped after running out of space. */
+#define INTERCEPT_DISK_FULL_RETRY 10
+
+/* Bounds of the backoff, in milliseconds, of on_write_failure = retry */
+#define INTERCEPT_RETRY_MIN_DELAY 100
+#define INTERCEPT_RETRY_MAX_DELAY 60000
+
+/*
+ * A segment of an intercept log file is identified by its start time, in
+ * seconds, shifted left by INTERCEPT_SEGMENT_SEQ_BITS, plus a sequence number
+ * that tells apart the segments started within the same second.
+ */
+#define INTERCEPT_SEGMENT_SEQ_BITS 16
+#define INTERCEPT_SEGMENT_SEQ_MAX ((UINT64CONST(1) << INTERCEPT_SEGMENT_SEQ_BITS) - 1)
+#define INTERCEPT_SEGMENT_TIME(segment) \
+	((pg_time_t) ((segment) >> INTERCEPT_SEGMENT_SEQ_BITS))
+#define INTERCEPT_SEGMENT_SEQ(segment) \
+	((uint32) ((segment) & INTERCEPT_SEGMENT_SEQ_MAX))
+
+/*
+ * Length of the segment start time in file names, and of the whole segment
+ * stamp, sequence number included, with the terminator
+ */
+#define INTERCEPT_TIME_LEN sizeof("YYYY-MM-DD_HHMMSS")
+#define INTERCEPT_STAMP_LEN sizeof("YYYY-MM-DD_HHMMSS-65535")
+
+/*
+ * A sealed segment of an intercept log file, as seen by the retention worker.
+ */
+typedef struct InterceptLogSegment
+{
+	char		name[MAXPGPATH];
+	uint64		size;
+	pg_time_t	mtime;
+	char		time[INTERCEPT_TIME_LEN];	/* start time, as in the name */
+	uint32		seq;			/* sequence number within that second */
+} InterceptLogSegment;
+
 /* GUC Variables */
 static int log_level = LOG_LEVEL_NONE;
+static char *log_levels = NULL;
 static char *log_directory = NULL;
+static int	log_format = INTERCEPT_FORMAT_TEXT;
+static char *line_prefix = NULL;
+static int	buffer_size = 0;
+static int	flush_interval = 1000;
+static int	ring_buffer_size = 0;
+static bool override_log_min_messages = false;
+static char *fields = NULL;
+static int	max_statement_length = -1;
+static char *include_patterns = NULL;
+static char *exclude_patterns = NULL;
+static char *include_sqlstates = NULL;
+static char *exclude_sqlstates = NULL;
+static char *backend_types = NULL;
+static char *databases = NULL;
+static char *roles = NULL;
+static char *application_names = NULL;
+static char *locations = NULL;
+static bool deduplicate_statements = false;
+static int	on_write_failure = INTERCEPT_FAILURE_DROP;
+static int	rate_limit = 0;
+static int	rate_limit_burst = 100;
+static bool deferred_formatting = false;
+static int	rotation_age = 0;
+static int	rotation_size = 0;
+static int	retention_age = 0;
+static int	retention_size = 0;
+
+/*
+ * Intercept log files opened so far by this backend, indexed by the elevel
+ * whose messages go into the file (see intercept_log_slot).  These are kept
+ * open across messages so that the steady-state cost of intercepting a
+ * message is a single write() call.
+ */
+static InterceptLogFile intercept_log_files[INTERCEPT_NUM_SLOTS];
+
+/*
+ * Processes that registered the exit callbacks that close the files and flush
+ * the buffers.  Children of the postmaster don't keep its callbacks, hence
+ * the pids rather than flags.
+ */
+static int	intercept_log_files_cleanup_pid = 0;
+static int	intercept_log_buffers_cleanup_pid = 0;
+
+/*
+ * Does the postmaster open the intercept log files for its children to
+ * inherit?  Set once _PG_init is done defining the GUCs.
+ */
+static bool open_intercept_log_files_for_children = false;
+
+/* Are we intercepting a message or flushing the intercepted ones? */
+static bool in_intercept_log_hook = false;
+
+/* Shared state, NULL if not loaded via shared_preload_libraries */
+static InterceptSharedState *intercept_shared = NULL;
+
+/* Are we the writer process? */
+static bool am_intercept_writer = false;
+
+/* intercept_shared->disk_full_until, when not loaded via shared_preload_libraries */
+static pg_time_t local_disk_full_until = 0;
 
-/* Original Hook */
+/*
+ * Whether our log_directory and log_format are the same as the writer's, as
+ * of the given destination_generation.  Only then can our lines go through the
+ * ring.
+ */
+static bool ring_destination_checked = false;
+static bool ring_destination_matches = false;
+static uint32 ring_destination_generation = 0;
+
+/* line_prefix, as compiled by its check hook */
+static InterceptPrefix *intercept_prefix = NULL;
+
+/* include_patterns and exclude_patterns, see InterceptFilter */
+static InterceptFilter intercept_include_filter = {0};
+static InterceptFilter intercept_exclude_filter = {0};
+
+/* include_sqlstates and exclude_sqlstates, as compiled by their check hooks */
+static InterceptSqlstates *intercept_include_sqlstates = NULL;
+static InterceptSqlstates *intercept_exclude_sqlstates = NULL;
+
+/* backend_types, databases, roles and application_names, compiled likewise */
+static InterceptNameList *intercept_backend_types = NULL;
+static InterceptNameList *intercept_databases = NULL;
+static InterceptNameList *intercept_roles = NULL;
+static InterceptNameList *intercept_application_names = NULL;
+
+/* See intercept_process_wanted */
+static InterceptProcessVerdict intercept_process_verdict = {0};
+
+/* locations, compiled likewise, and its verdicts, see intercept_location_wanted */
+static InterceptNameList *intercept_locations = NULL;
+static HTAB *intercept_location_cache = NULL;
+static InterceptLocationKey intercept_last_location = {0};
+static bool intercept_last_location_wanted = false;
+
+/* See get_prefix_constants */
+static InterceptPrefixConstants intercept_prefix_constants = {0};
+
+/*
+ * Strings interned into the binary intercept log files by this backend, and
+ * the pid they were interned by, which tells a child of the postmaster that
+ * the ids aren't its own.
+ */
+static HTAB *intercept_intern_table = NULL;
+static int	intercept_intern_pid = 0;
+static uint32 intercept_intern_next_id = 1;
+
+/*
+ * Levels to intercept, as per log_level and log_levels.  log_levels_mask is
+ * the part that comes from log_levels.
+ */
+static uint32 intercept_level_mask = 0;
+static uint32 log_levels_mask = 0;
+
+/* INTERCEPT_FIELD_* bits of the fields to write, as per fields */
+static uint32 intercept_field_mask = INTERCEPT_FIELD_ALL;
+
+/*
+ * With override_log_min_messages, the log_min_messages that the server was
+ * configured with and the lowered value that we put in its place, so that
+ * the server emits the messages we want to intercept.  A log_min_messages that
+ * differs from lowered_log_min_messages means it was set behind our back.
+ */
+static int	admin_log_min_messages = WARNING;
+static int	lowered_log_min_messages = WARNING;
+static bool log_min_messages_lowered = false;
+
+/* Hooks of log_min_messages that ours chain to, see hook_log_min_messages */
+static GucEnumCheckHook prev_log_min_messages_check_hook = NULL;
+static GucEnumAssignHook prev_log_min_messages_assign_hook = NULL;
+
+/*
+ * Buffer the messages are formatted in.  It lives in a memory context of its
+ * own and is reused from message to message, so formatting doesn't allocate
+ * in the steady state and doesn't depend on ErrorContext having space.
+ */
+static MemoryContext intercept_format_context = NULL;
+static StringInfoData intercept_format_buf;
+
+/* Running average of the formatted message size, to size the buffer by. */
+static int	intercept_format_size_hint = INTERCEPT_FORMAT_BUFFER_MIN_SIZE;
+
+/* Original Hooks */
 static emit_log_hook_type original_emit_log_hook = NULL;
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
 /* Function declarations */
 static bool check_intercept_log_directory(char **newval, void **extra,
 										  GucSource source);
+static void assign_intercept_log_directory(const char *newval, void *extra);
+static void assign_intercept_log_format(int newval, void *extra);
+static bool check_intercept_line_prefix(char **newval, void **extra,
+										GucSource source);
+static void assign_intercept_line_prefix(const char *newval, void *extra);
+static void reset_intercept_log_destination(void);
+static void register_intercept_log_files_cleanup(void);
+static void open_intercept_log_files_in_postmaster(bool create);
 static inline bool is_log_level_output(int elevel, int log_min_level);
 static bool check_intercept_log_level(int *newval, void **extra,
 									  GucSource source);
+static void assign_intercept_log_level(int newval, void *extra);
+static bool check_intercept_log_levels(char **newval, void **extra,
+									   GucSource source);
+static void assign_intercept_log_levels(const char *newval, void *extra);
+static bool check_intercept_fields(char **newval, void **extra,
+								   GucSource source);
+static void assign_intercept_fields(const char *newval, void *extra);
+static bool check_intercept_patterns(char **newval, void **extra,
+									 const char *name);
+static bool check_intercept_include_patterns(char **newval, void **extra,
+											 GucSource source);
+static bool check_intercept_exclude_patterns(char **newval, void **extra,
+											 GucSource source);
+static void set_intercept_filter(InterceptFilter *filter,
+								 InterceptPatterns *patterns);
+static void assign_intercept_include_patterns(const char *newval, void *extra);
+static void assign_intercept_exclude_patterns(const char *newval, void *extra);
+static bool check_intercept_sqlstates(char **newval, void **extra);
+static bool check_intercept_include_sqlstates(char **newval, void **extra,
+											  GucSource source);
+static bool check_intercept_exclude_sqlstates(char **newval, void **extra,
+											  GucSource source);
+static void assign_intercept_include_sqlstates(const char *newval,
+											   void *extra);
+static void assign_intercept_exclude_sqlstates(const char *newval,
+											   void *extra);
+static inline bool intercept_sqlstate_matches(InterceptSqlstates *sqlstates,
+											  int sqlerrcode);
+static bool check_intercept_name_list(char **newval, void **extra);
+static bool split_intercept_guc_list(char *rawstring, List **namelist);
+static bool check_intercept_backend_types(char **newval, void **extra,
+										  GucSource source);
+static bool check_intercept_databases(char **newval, void **extra,
+									  GucSource source);
+static bool check_intercept_roles(char **newval, void **extra,
+								  GucSource source);
+static bool check_intercept_application_names(char **newval, void **extra,
+											  GucSource source);
+static void assign_intercept_backend_types(const char *newval, void *extra);
+static void assign_intercept_databases(const char *newval, void *extra);
+static void assign_intercept_roles(const char *newval, void *extra);
+static void assign_intercept_application_names(const char *newval,
+											   void *extra);
+static bool intercept_name_list_allows(InterceptNameList *list,
+									   const char *name,
+									   bool case_insensitive);
+static bool intercept_object_list_allows(InterceptNameList *list,
+										 const char *name, Oid oid);
+static void compute_intercept_process_verdict(void);
+static inline bool intercept_process_wanted(void);
+static bool check_intercept_locations(char **newval, void **extra,
+									  GucSource source);
+static void assign_intercept_locations(const char *newval, void *extra);
+static bool compute_intercept_location_verdict(const char *funcname,
+											   const char *filename);
+static inline bool intercept_location_wanted(const char *funcname,
+											 const char *filename);
+static bool intercept_filter_matches(InterceptFilter *filter,
+									 const char *message, int len);
+static inline bool intercept_message_wanted(ErrorData *edata);
+static uint64 intercept_message_template_hash(ErrorData *edata);
+static void claim_intercept_rate_bucket(InterceptRateBucket *bucket,
+										uint64 key, ErrorData *edata,
+										TimestampTz now);
+static InterceptRateBucket *get_intercept_rate_bucket(uint64 key,
+													  ErrorData *edata,
+													  TimestampTz now);
+static bool intercept_rate_limit_allows(ErrorData *edata, uint64 *suppressed);
+static void emit_intercept_suppressed_summary(ErrorData *edata,
+											  uint64 suppressed);
+static void flush_intercept_suppressed_summaries(bool all);
+static void emit_intercept_log_message_rate_limited(ErrorData *edata);
+static inline uint32 intercept_level_bits(int elevel);
+static void assign_override_log_min_messages(bool newval, void *extra);
+static int	lower_log_min_level(int log_min_level, int elevel);
+static int	get_lowered_log_min_messages(int configured, uint32 level_mask,
+										 bool override);
+static bool check_log_min_messages(int *newval, void **extra,
+								   GucSource source);
+static void assign_log_min_messages(int newval, void *extra);
+static void hook_log_min_messages(void);
+static void apply_log_min_messages_override(uint32 level_mask,
+											bool override);
 static void intercept_log(ErrorData *edata);
 static const char *intercept_log_severity(int elevel);
 static void write_console(const char *line, int len);
+static inline int intercept_log_slot(int elevel);
+static void format_intercept_segment_stamp(char *stamp, uint64 segment);
+static void get_intercept_log_file_path(char *path, int elevel,
+										uint64 segment_start);
+static uint64 get_intercept_log_segment(int slot);
+static uint64 rotate_intercept_log_segment(int slot, uint64 segment_start);
+static const char *intercept_log_file_extension(void);
+static int open_intercept_log_file(int elevel, bool *cached);
+static void close_intercept_log_file(InterceptLogFile *file);
+static void close_intercept_log_files(void);
+static void close_intercept_log_files_at_exit(int code, Datum arg);
+static bool write_intercept_log_file(int elevel, const char *data, int len,
+									 bool *open_failed);
+static bool intercept_log_file_backing_off(InterceptLogFile *file);
+static void discard_intercept_log_data(InterceptLogFile *file,
+									   const char *data, int len);
+static bool intercept_log_file_failed(int elevel, const char *data, int len,
+									  bool open_failed, bool can_keep);
+static void report_intercept_log_file_error(int elevel,
+											bool open_failed);
+static bool buffer_intercept_log_line(int elevel, const char *line, int len,
+									  int size);
+static void flush_intercept_log_buffer(int elevel);
+static void flush_intercept_log_buffers(void);
+static void flush_intercept_log_buffers_outside_hook(void);
+static void intercept_xact_callback(XactEvent event, void *arg);
+static void flush_intercept_log_buffers_at_exit(int code, Datum arg);
 static void write_file(const char *line, int len, int elevel);
-static void append_with_tabs(StringInfo buf, const char *str);
-static void add_prefix(StringInfo buf, ErrorData *edata);
+static Size intercept_shmem_size(void);
+static void intercept_shmem_request(void);
+static void intercept_shmem_startup(void);
+static bool use_intercept_ring(void);
+static bool insert_into_intercept_ring(const char *line, int len, int elevel,
+									   bool deferred);
+static void publish_intercept_writer_destination(void);
+static void drain_intercept_ring(void);
+static void intercept_writer_exit(int code, Datum arg);
+static bool intercept_disk_full(void);
+static void set_intercept_disk_full(bool full);
+static bool parse_intercept_log_segment_name(const char *name,
+											 char current_stamps[][INTERCEPT_STAMP_LEN],
+											 InterceptLogSegment *segment,
+											 bool *sealed);
+static int	intercept_log_segment_cmp(const void *a, const void *b);
+static void enforce_intercept_log_retention(void);
+static void append_with_tabs_len(StringInfo buf, const char *str, size_t len);
+static void format_intercept_log_time(char *formatted_log_time,
+									  const struct timeval *tv);
+static void pad_from(StringInfo buf, int start, int padding);
+static void append_hex(StringInfo buf, uint64 value);
+static void render_prefix_constants(InterceptPrefixConstants *constants,
+									InterceptLogRecord *record);
+static InterceptPrefixConstants *get_prefix_constants(InterceptLogRecord *record);
+static void add_prefix(StringInfo buf, InterceptLogRecord *record);
+static void build_intercept_log_record(InterceptLogRecord *record,
+									   ErrorData *edata);
+static uint32 get_intercept_statement_id(void);
+static void append_statement_id(StringInfo buf, InterceptLogRecord *record);
+static inline void add_line_start(StringInfo buf, InterceptLogRecord *record,
+								  bool compact);
+static void format_text_intercept_log_record(StringInfo buf,
+											 InterceptLogRecord *record,
+											 bool compact);
+static inline bool json_chunk_needs_escape(uint64 chunk);
+static void append_json_string_len(StringInfo buf, const char *str,
+								   size_t len);
+static void append_json_key_value_len(StringInfo buf, const char *key,
+									  const char *value, size_t len);
+static void append_json_key_int(StringInfo buf, const char *key, int value);
+static void format_json_intercept_log_record(StringInfo buf,
+											 InterceptLogRecord *record);
+static void append_int(StringInfo buf, int32 value);
+static void append_uint(StringInfo buf, uint32 value);
+static void append_csv_literal(StringInfo buf, const char *str, int len);
+static void insert_truncation_marker(StringInfo buf);
+static const char *get_formatted_session_start_time(pg_time_t session_start);
+static void format_csv_intercept_log_record(StringInfo buf,
+											InterceptLogRecord *record);
+static int	begin_binary_unit(StringInfo buf, char type);
+static void end_binary_unit(StringInfo buf, int start);
+static void append_varint(StringInfo buf, uint64 value);
+static void append_binary_string(StringInfo buf, const char *str, int len);
+static void *intercept_hash_alloc(Size size);
+static HTAB *create_intercept_hash(const char *name, Size keysize,
+								   Size entrysize);
+static void clear_intercept_hash(HTAB *table);
+static bool intern_intercept_string(StringInfo buf, const char *str,
+									int slot, uint32 *id);
+static void format_binary_intercept_log_record(StringInfo buf,
+											   InterceptLogRecord *record,
+											   bool intern);
+static uint64 read_binary_varint(StringInfo unit);
+static char *read_binary_string(StringInfo unit, int *len);
+static const char *lookup_decoded_string(HTAB *strings, int pid, uint32 id);
+static const char *read_binary_interned_string(StringInfo unit, HTAB *strings,
+											   int pid);
+static void decode_binary_intercept_log_record(StringInfo unit, HTAB *strings,
+											   InterceptLogRecord *record);
+static void format_decoded_intercept_log_record(StringInfo buf,
+												InterceptLogRecord *record,
+												int format);
+static StringInfo render_deferred_intercept_log_record(const char *data,
+													   int len);
+static void init_intercept_format_buffer(int size);
+static void size_intercept_format_buffer(int len);
 static void prepare_and_emit_intercept_log_message(ErrorData *edata);
 
+static const struct
+{
+	const char *name;
+	uint32		bits;
+}			intercept_field_options[] = {
+	{"all", INTERCEPT_FIELD_ALL},
+	{"message", INTERCEPT_FIELD_MESSAGE},
+	{"detail", INTERCEPT_FIELD_DETAIL},
+	{"hint", INTERCEPT_FIELD_HINT},
+	{"query", INTERCEPT_FIELD_QUERY},
+	{"context", INTERCEPT_FIELD_CONTEXT},
+	{"location", INTERCEPT_FIELD_LOCATION},
+	{"backtrace", INTERCEPT_FIELD_BACKTRACE},
+	{"statement", INTERCEPT_FIELD_STATEMENT},
+	{NULL, 0}
+};
+
+static const struct config_enum_entry log_format_options[] = {
+	{"text", INTERCEPT_FORMAT_TEXT, false},
+	{"compact", INTERCEPT_FORMAT_COMPACT, false},
+	{"json", INTERCEPT_FORMAT_JSON, false},
+	{"csv", INTERCEPT_FORMAT_CSV, false},
+	{"binary", INTERCEPT_FORMAT_BINARY, false},
+	{NULL, 0, false}
+};
+
+static const struct config_enum_entry on_write_failure_options[] = {
+	{"drop", INTERCEPT_FAILURE_DROP, false},
+	{"retry", INTERCEPT_FAILURE_RETRY, false},
+	{"stderr", INTERCEPT_FAILURE_STDERR, false},
+	{NULL, 0, false}
+};
+
 /*
  * This structure is similar to server_message_level_options in guc.c, except
  * LOG_LEVEL_NONE.
@@ -80,7 +998,52 @@ static const struct config_enum_entry log_level_options[] = {
 void
 _PG_init(void)
 {
-	/* Define custom GUC variables */
+	int			i;
+
+	/*
+	 * Initialize the file cache before defining the GUCs, as the assign hook
+	 * of log_directory looks at it.
+	 */
+	for (i = 0; i < INTERCEPT_NUM_SLOTS; i++)
+	{
+		intercept_log_files[i].fd = -1;
+		intercept_log_files[i].external_fd = false;
+		intercept_log_files[i].inherited = false;
+		intercept_log_files[i].generation = 1;
+	}
+
+	/* Set up the format buffer while it's safe to allocate memory. */
+	intercept_format_context = AllocSetContextCreate(TopMemoryContext,
+													 "pg_intercept_server_logs format buffer",
+													 ALLOCSET_SMALL_SIZES);
+	init_intercept_format_buffer(INTERCEPT_FORMAT_BUFFER_MIN_SIZE);
+	intercept_intern_table =
+		create_intercept_hash("pg_intercept_server_logs interned strings",
+							  sizeof(const char *),
+							  sizeof(InterceptInternEntry));
+	intercept_intern_pid = MyProcPid;
+	intercept_location_cache =
+		create_intercept_hash("pg_intercept_server_logs locations",
+							  sizeof(InterceptLocationKey),
+							  sizeof(InterceptLocationEntry));
+
+	hook_log_min_messages();
+
+	/*
+	 * Define custom GUC variables.  override_log_min_messages goes first, as
+	 * the check hook of log_level looks at it.
+	 */
+	DefineCustomBoolVariable("pg_intercept_server_logs.override_log_min_messages",
+							 gettext_noop("Lowers \"log_min_messages\" to intercept messages the server is not configured to emit."),
+							 gettext_noop("The messages below the configured \"log_min_messages\" go only to the intercept destination, not to the server log."),
+							 &override_log_min_messages,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 assign_override_log_min_messages,
+							 NULL);
+
 	DefineCustomEnumVariable("pg_intercept_server_logs.log_level",
 							 gettext_noop("Log level to intercept."),
 							 gettext_noop("Ensure that the server is set to emit logs at \"pg_intercept_server_logs.log_level\" via \"log_min_messages\" parameter setting."),
@@ -90,9 +1053,20 @@ _PG_init(void)
 							 PGC_USERSET,
 							 0,
 							 check_intercept_log_level,
-							 NULL,
+							 assign_intercept_log_level,
 							 NULL);
 
+	DefineCustomStringVariable("pg_intercept_server_logs.log_levels",
+							   gettext_noop("List of log levels to intercept, in addition to \"pg_intercept_server_logs.log_level\"."),
+							   gettext_noop("Messages of each level go into their own file."),
+							   &log_levels,
+							   "",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_log_levels,
+							   assign_intercept_log_levels,
+							   NULL);
+
 	DefineCustomStringVariable("pg_intercept_server_logs.log_directory",
 							   gettext_noop("Destination directory to store intercepted server log messages into a file."),
 							   gettext_noop("Log file name will be of the form \"log_level.log\"."),
@@ -101,46 +1075,369 @@ _PG_init(void)
 							   PGC_USERSET,
 							   0,
 							   check_intercept_log_directory,
-							   NULL,
+							   assign_intercept_log_directory,
 							   NULL);
 
-	/*
-	 * XXX: An option (list of comma separated strings) to specify more than
-	 * one interested log levels, say, log_levels = 'debug1, error, panic';
-	 * Use SplitGUCList to parse the list.
-	 */
+	DefineCustomStringVariable("pg_intercept_server_logs.line_prefix",
+							   gettext_noop("Prefix of each line of the intercepted messages in text format."),
+							   gettext_noop("Supports the same escapes as \"log_line_prefix\"."),
+							   &line_prefix,
+							   "%m [%p] ",
+							   PGC_USERSET,
+							   0,
+							   check_intercept_line_prefix,
+							   assign_intercept_line_prefix,
+							   NULL);
 
-	/*
-	 * XXX: An option to specify substring to intercept the logs that matches
-	 * it, helps capturing logs at more granular level.
-	 */
+	DefineCustomEnumVariable("pg_intercept_server_logs.log_format",
+							 gettext_noop("Format of the intercepted messages."),
+							 gettext_noop("With \"compact\", the prefix is written only on the first line of each message, the other lines being indented with a tab. With \"json\", each message is written as a JSON object on a line of its own, into a file of the form \"log_level.json\". With \"csv\", each message is written as a line of the server's csvlog columns, into a file of the form \"log_level.csv\". With \"binary\", each message is written as a binary record into a file of the form \"log_level.bin\", to be rendered with pg_intercept_server_logs_decode(); without a log_directory, the messages are written to stderr as text instead."),
+							 &log_format,
+							 INTERCEPT_FORMAT_TEXT,
+							 log_format_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 assign_intercept_log_format,
+							 NULL);
 
-	/*
-	 * XXX: An option clean the old logs in the log_directory before generating
-	 * new logs.
-	 */
+	DefineCustomEnumVariable("pg_intercept_server_logs.on_write_failure",
+							 gettext_noop("What to do with the intercepted messages that couldn't be written out."),
+							 gettext_noop("With \"drop\", they are discarded. With \"retry\", the buffered ones are kept and the file is tried again after a backoff, the messages coming in meanwhile being discarded. With \"stderr\", they are written to the standard error instead. Either way, the failure is counted rather than reported."),
+							 &on_write_failure,
+							 INTERCEPT_FAILURE_DROP,
+							 on_write_failure_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
 
-	/*
-	 * XXX: Add ability to write the intercepted logs to remote storage or
-	 * data lake or any other analytical databases or data stores.
-	 */
+	DefineCustomStringVariable("pg_intercept_server_logs.fields",
+							   gettext_noop("List of fields of the intercepted messages to write."),
+							   gettext_noop("Any of \"message\", \"detail\", \"hint\", \"query\", \"context\", \"location\", \"backtrace\" and \"statement\", or \"all\"."),
+							   &fields,
+							   "all",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_fields,
+							   assign_intercept_fields,
+							   NULL);
 
-	/*
-	 * XXX: Add ability to write the intercepted logs to console stdout or
-	 * stderr.
-	 */
+	DefineCustomStringVariable("pg_intercept_server_logs.include_patterns",
+							   gettext_noop("List of patterns of which the intercepted messages must match one."),
+							   gettext_noop("Each is a substring of the message text, or a regular expression if written between slashes. Empty intercepts all the messages."),
+							   &include_patterns,
+							   "",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_include_patterns,
+							   assign_intercept_include_patterns,
+							   NULL);
 
-	/*
-	 * XXX: Change log file name to be of the form log_level_timestamp.log,
-	 * where timestamp is the time at which log_level was set to a new value.
-	 */
+	DefineCustomStringVariable("pg_intercept_server_logs.exclude_patterns",
+							   gettext_noop("List of patterns of which the intercepted messages must match none."),
+							   gettext_noop("Each is a substring of the message text, or a regular expression if written between slashes."),
+							   &exclude_patterns,
+							   "",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_exclude_patterns,
+							   assign_intercept_exclude_patterns,
+							   NULL);
 
-	/*
-	 * XXX: Add ability to generate intercepted logs in JSON or CSV format.
-	 */
+	DefineCustomStringVariable("pg_intercept_server_logs.backend_types",
+							   gettext_noop("List of the backend types whose messages are intercepted."),
+							   gettext_noop("Backend types as in pg_stat_activity.backend_type, spaces included, as in \"client backend, !autovacuum worker\". Those preceded by \"!\" are left out instead. Empty intercepts the messages of all the processes."),
+							   &backend_types,
+							   "",
+							   PGC_SUSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_backend_types,
+							   assign_intercept_backend_types,
+							   NULL);
+
+	DefineCustomStringVariable("pg_intercept_server_logs.databases",
+							   gettext_noop("List of the databases whose sessions' messages are intercepted."),
+							   gettext_noop("Database names or OIDs. Those preceded by \"!\" are left out instead. Names apply to the client sessions, OIDs to all the processes connected to a database. Empty intercepts the messages of all the processes."),
+							   &databases,
+							   "",
+							   PGC_SUSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_databases,
+							   assign_intercept_databases,
+							   NULL);
+
+	DefineCustomStringVariable("pg_intercept_server_logs.roles",
+							   gettext_noop("List of the roles whose sessions' messages are intercepted."),
+							   gettext_noop("Names or OIDs of the roles as logged in with. Those preceded by \"!\" are left out instead. Names apply to the client sessions, OIDs to all the processes connected as a role. Empty intercepts the messages of all the processes."),
+							   &roles,
+							   "",
+							   PGC_SUSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_roles,
+							   assign_intercept_roles,
+							   NULL);
+
+	DefineCustomStringVariable("pg_intercept_server_logs.application_names",
+							   gettext_noop("List of the application_name values whose messages are intercepted."),
+							   gettext_noop("Those preceded by \"!\" are left out instead. Empty intercepts the messages whatever the application_name."),
+							   &application_names,
+							   "",
+							   PGC_SUSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_application_names,
+							   assign_intercept_application_names,
+							   NULL);
+
+	DefineCustomStringVariable("pg_intercept_server_logs.locations",
+							   gettext_noop("List of the functions and source files whose messages are intercepted."),
+							   gettext_noop("Names containing a dot are of source files, the others of C functions. Those preceded by \"!\" are left out instead. Empty intercepts the messages from anywhere."),
+							   &locations,
+							   "",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_locations,
+							   assign_intercept_locations,
+							   NULL);
+
+	DefineCustomStringVariable("pg_intercept_server_logs.include_sqlstates",
+							   gettext_noop("List of SQLSTATEs and SQLSTATE classes of which the intercepted messages must have one."),
+							   gettext_noop("Each is a 5-character SQLSTATE, or a 2-character class. Empty intercepts all the messages."),
+							   &include_sqlstates,
+							   "",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_include_sqlstates,
+							   assign_intercept_include_sqlstates,
+							   NULL);
+
+	DefineCustomStringVariable("pg_intercept_server_logs.exclude_sqlstates",
+							   gettext_noop("List of SQLSTATEs and SQLSTATE classes of which the intercepted messages must have none."),
+							   gettext_noop("Each is a 5-character SQLSTATE, or a 2-character class."),
+							   &exclude_sqlstates,
+							   "",
+							   PGC_USERSET,
+							   GUC_LIST_INPUT,
+							   check_intercept_exclude_sqlstates,
+							   assign_intercept_exclude_sqlstates,
+							   NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.rate_limit",
+							gettext_noop("Maximum rate, in messages per second, at which the messages of a template are intercepted."),
+							gettext_noop("A template is a message format string raised from a source location. The messages beyond are suppressed, their count being written ahead of the next one let through, or once they stop coming. Takes effect only when the module is loaded via shared_preload_libraries. 0 disables rate limiting."),
+							&rate_limit,
+							0,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.rate_limit_burst",
+							gettext_noop("Number of messages of a template intercepted in a row before pg_intercept_server_logs.rate_limit kicks in."),
+							NULL,
+							&rate_limit_burst,
+							100,
+							1,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.max_statement_length",
+							gettext_noop("Maximum length of the statement written with the intercepted messages."),
+							gettext_noop("Longer statements are cut and end with \"...\". -1 writes statements in full."),
+							&max_statement_length,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_BYTE,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable("pg_intercept_server_logs.deduplicate_statements",
+							 gettext_noop("Writes the statement only with the first intercepted message it emits."),
+							 gettext_noop("The other messages of the statement refer to it by an id. Has no effect with the csv format."),
+							 &deduplicate_statements,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("pg_intercept_server_logs.deferred_formatting",
+							 gettext_noop("Leaves the formatting of the intercepted messages to the writer process."),
+							 gettext_noop("Backends copy the raw fields of the messages into the shared ring buffer, and the writer process formats them as per its own settings."),
+							 &deferred_formatting,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.buffer_size",
+							gettext_noop("Size of the per-backend buffer that intercepted messages are collected in before being written to the intercept log file."),
+							gettext_noop("0 writes every intercepted message to the file as soon as it is intercepted. FATAL and PANIC messages are never buffered."),
+							&buffer_size,
+							0,
+							0,
+							16 * 1024,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.flush_interval",
+							gettext_noop("Maximum time intercepted messages are kept in the buffer."),
+							gettext_noop("Checked whenever a message is intercepted; the buffer is also flushed when it fills up, at transaction end and at backend exit. 0 disables time-based flushing."),
+							&flush_interval,
+							1000,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.rotation_age",
+							gettext_noop("Time after which a new intercept log file is started for each level."),
+							gettext_noop("Takes effect only when loaded via \"shared_preload_libraries\". 0 disables time-based rotation."),
+							&rotation_age,
+							0,
+							0,
+							INT_MAX / SECS_PER_MINUTE,
+							PGC_SIGHUP,
+							GUC_UNIT_MIN,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.rotation_size",
+							gettext_noop("Size after which a new intercept log file is started for each level."),
+							gettext_noop("Takes effect only when loaded via \"shared_preload_libraries\". 0 disables size-based rotation."),
+							&rotation_size,
+							0,
+							0,
+							INT_MAX / 1024,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.retention_age",
+							gettext_noop("Age after which rotated intercept log files are removed."),
+							gettext_noop("Removal is done by a background worker, which runs only if this or \"pg_intercept_server_logs.retention_size\" is set at server start. 0 disables age-based removal."),
+							&retention_age,
+							0,
+							0,
+							INT_MAX / SECS_PER_MINUTE,
+							PGC_SIGHUP,
+							GUC_UNIT_MIN,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.retention_size",
+							gettext_noop("Total size of the intercept log files beyond which the oldest rotated ones are removed."),
+							gettext_noop("Removal is done by a background worker, which runs only if this or \"pg_intercept_server_logs.retention_age\" is set at server start. 0 disables size-based removal."),
+							&retention_size,
+							0,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_intercept_server_logs.ring_buffer_size",
+							gettext_noop("Size of the shared ring buffer through which a background writer process writes the intercepted messages to the intercept log files."),
+							gettext_noop("Takes effect only when loaded via \"shared_preload_libraries\". 0 makes every backend write its intercepted messages itself."),
+							&ring_buffer_size,
+							0,
+							0,
+							1024 * 1024,
+							PGC_POSTMASTER,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	/*
+	 * XXX: Add ability to write the intercepted logs to remote storage or
+	 * data lake or any other analytical databases or data stores.
+	 */
+
+	/*
+	 * XXX: Add ability to write the intercepted logs to console stdout or
+	 * stderr.
+	 */
 
 	MarkGUCPrefixReserved("pg_intercept_server_logs");
 
+	/* Flush the buffered messages at every transaction end, among others. */
+	RegisterXactCallback(intercept_xact_callback, NULL);
+
+	/*
+	 * Set up the shared state that rotation goes through, and the shared ring
+	 * buffer and its writer process if asked.
+	 */
+	if (process_shared_preload_libraries_in_progress)
+	{
+		prev_shmem_request_hook = shmem_request_hook;
+		shmem_request_hook = intercept_shmem_request;
+		prev_shmem_startup_hook = shmem_startup_hook;
+		shmem_startup_hook = intercept_shmem_startup;
+	}
+
+	if (process_shared_preload_libraries_in_progress && ring_buffer_size > 0)
+	{
+		BackgroundWorker worker;
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+		worker.bgw_restart_time = 1;
+		strcpy(worker.bgw_library_name, "pg_intercept_server_logs");
+		strcpy(worker.bgw_function_name, "pg_intercept_server_logs_writer_main");
+		strcpy(worker.bgw_name, "pg_intercept_server_logs writer");
+		strcpy(worker.bgw_type, "pg_intercept_server_logs writer");
+		RegisterBackgroundWorker(&worker);
+	}
+
+	/*
+	 * Set up the retention worker, if asked.  It also writes out the summaries
+	 * of the messages suppressed by rate_limit once their storm is over, which
+	 * the processes that got them suppressed may not live to do.
+	 */
+	if (process_shared_preload_libraries_in_progress &&
+		(retention_age > 0 || retention_size > 0 || rate_limit > 0))
+	{
+		BackgroundWorker worker;
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+		worker.bgw_restart_time = 10;
+		strcpy(worker.bgw_library_name, "pg_intercept_server_logs");
+		strcpy(worker.bgw_function_name, "pg_intercept_server_logs_retention_main");
+		strcpy(worker.bgw_name, "pg_intercept_server_logs retention");
+		strcpy(worker.bgw_type, "pg_intercept_server_logs retention");
+		RegisterBackgroundWorker(&worker);
+	}
+
 	/* Install Hooks */
 	original_emit_log_hook = emit_log_hook;
 	emit_log_hook = intercept_log;
@@ -152,8 +1449,10 @@ _PG_init(void)
 void
 _PG_fini(void)
 {
-	/* Uninstall hook */
+	/* Uninstall hooks */
 	emit_log_hook = original_emit_log_hook;
+	shmem_request_hook = prev_shmem_request_hook;
+	shmem_startup_hook = prev_shmem_startup_hook;
 }
 
 /*
@@ -182,276 +1481,5324 @@ check_intercept_log_directory(char **newval, void **extra, GucSource source)
 		return false;
 	}
 
-	/*
-	 * Do a basic sanity check that the specified archive directory exists.  It
-	 * could be removed at some point in the future, so we still need to be
-	 * prepared for it not to exist in the actual archiving logic.
-	 */
-	if (stat(*newval, &st) != 0 || !S_ISDIR(st.st_mode))
+	/*
+	 * Do a basic sanity check that the specified archive directory exists.  It
+	 * could be removed at some point in the future, so we still need to be
+	 * prepared for it not to exist in the actual archiving logic.
+	 */
+	if (stat(*newval, &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+		GUC_check_errdetail("specified intercept log directory does not exist");
+		return false;
+	}
+
+	return true;
+}
+
+static void
+assign_intercept_log_directory(const char *newval, void *extra)
+{
+	reset_intercept_log_destination();
+}
+
+static void
+assign_intercept_log_format(int newval, void *extra)
+{
+	reset_intercept_log_destination();
+}
+
+/*
+ * Compiles the provided line prefix into a list of ops, so that formatting a
+ * prefix doesn't have to parse the template over and over again.
+ *
+ * Escapes are parsed the way log_line_prefix's are, unknown ones being
+ * ignored like the server does.
+ */
+static bool
+check_intercept_line_prefix(char **newval, void **extra, GucSource source)
+{
+	const char *template = *newval ? *newval : "";
+	int			template_len = (int) strlen(template);
+	InterceptPrefix *prefix;
+	InterceptPrefixOp *op;
+	char	   *text;
+	int			text_len = 0;
+	const char *p;
+
+	/*
+	 * There can't be more ops than characters in the template, and there can't
+	 * be more literal text than that either.
+	 */
+	prefix = (InterceptPrefix *)
+		intercept_guc_malloc(offsetof(InterceptPrefix, ops) +
+							 sizeof(InterceptPrefixOp) * (template_len + 1) +
+							 template_len + 1);
+	if (prefix == NULL)
+		return false;
+
+	prefix->nops = 0;
+	op = NULL;
+	text = (char *) &prefix->ops[template_len + 1];
+
+	for (p = template; *p != '\0'; p++)
+	{
+		int			padding = 0;
+
+		if (*p != '%' || p[1] == '%')
+		{
+			/* Literal text, add to the current run of it. */
+			if (*p == '%')
+				p++;
+
+			if (op == NULL || op->escape != '\0')
+			{
+				op = &prefix->ops[prefix->nops++];
+				op->escape = '\0';
+				op->padding = 0;
+				op->offset = text_len;
+				op->len = 0;
+			}
+			text[text_len++] = *p;
+			op->len++;
+			continue;
+		}
+
+		/* Go to the char after '%', and parse the padding, if any. */
+		p++;
+		if (*p == '\0')
+			break;
+
+		if (*p == '-' || (*p >= '0' && *p <= '9'))
+		{
+			bool		negative = (*p == '-');
+
+			if (negative)
+				p++;
+			while (*p >= '0' && *p <= '9')
+			{
+				if (padding < 10000)
+					padding = padding * 10 + (*p - '0');
+				p++;
+			}
+			if (negative)
+				padding = -padding;
+			if (*p == '\0')
+				break;
+		}
+
+		switch (*p)
+		{
+			case 'a':
+			case 'u':
+			case 'd':
+			case 'b':
+			case 'p':
+			case 'P':
+			case 't':
+			case 'm':
+			case 'n':
+			case 'i':
+			case 'e':
+			case 'c':
+			case 'l':
+			case 's':
+			case 'v':
+			case 'x':
+			case 'q':
+			case 'Q':
+			case 'r':
+			case 'h':
+				op = &prefix->ops[prefix->nops++];
+				op->escape = *p;
+				op->padding = padding;
+				op->offset = 0;
+				op->len = 0;
+				break;
+			default:
+				/* format error - ignore it */
+				break;
+		}
+	}
+
+	/* Move the literal text right behind the ops. */
+	memmove((char *) &prefix->ops[prefix->nops], text, text_len);
+
+	*extra = (void *) prefix;
+
+	return true;
+}
+
+static void
+assign_intercept_line_prefix(const char *newval, void *extra)
+{
+	intercept_prefix = (InterceptPrefix *) extra;
+}
+
+/*
+ * Closes the cached intercept log files so that the subsequent messages get
+ * written into the files of the new log_directory or log_format.  Messages
+ * buffered so far belong to the old files, so write them out first.
+ */
+static void
+reset_intercept_log_destination(void)
+{
+	flush_intercept_log_buffers_outside_hook();
+	close_intercept_log_files();
+	ring_destination_checked = false;
+
+	open_intercept_log_files_in_postmaster(false);
+}
+
+/*
+ * Registers the exit callback that closes the intercept log files, once per
+ * process.
+ */
+static void
+register_intercept_log_files_cleanup(void)
+{
+	/* Make sure we don't leak the descriptors at backend exit. */
+	if (intercept_log_files_cleanup_pid != MyProcPid)
+	{
+		on_proc_exit(close_intercept_log_files_at_exit, (Datum) 0);
+		intercept_log_files_cleanup_pid = MyProcPid;
+	}
+}
+
+/*
+ * In the postmaster, opens the intercept log files of the levels being
+ * intercepted that aren't open yet, for the children it forks to inherit.
+ * Under connection churn, that keeps the cost of opening the files off every
+ * new backend's first intercepted message.
+ *
+ * The files are created only if create is set.  During a configuration
+ * reload, we're called from the assign hooks as each setting is assigned, and
+ * the files of a half-assigned configuration are not to be created; the
+ * children create the missing ones when they first need them, and the next
+ * reload opens them here.
+ *
+ * With EXEC_BACKEND, children don't inherit the descriptors, so there's no
+ * point.
+ */
+static void
+open_intercept_log_files_in_postmaster(bool create)
+{
+#ifndef EXEC_BACKEND
+	int			elevel;
+
+	if (!open_intercept_log_files_for_children || IsUnderPostmaster)
+		return;
+
+	if (log_directory == NULL || log_directory[0] == '\0')
+		return;
+
+	for (elevel = 0; elevel <= PANIC; elevel++)
+	{
+		InterceptLogFile *file;
+		int			slot;
+		uint64		segment_start;
+		char		fullpath[MAXPGPATH * 2];
+		int			fd;
+
+		if ((intercept_level_mask & INTERCEPT_LEVEL_BIT(elevel)) == 0)
+			continue;
+
+		slot = intercept_log_slot(elevel);
+		file = &intercept_log_files[slot];
+		segment_start = get_intercept_log_segment(slot);
+		if (file->fd >= 0)
+		{
+			if (file->segment_start == segment_start)
+				continue;
+			close_intercept_log_file(file);
+		}
+
+		file->segment_start = segment_start;
+		get_intercept_log_file_path(fullpath, elevel, segment_start);
+
+		/*
+		 * Keep the descriptors out of the programs that the children run,
+		 * such as archive_command.  Failures are left for the children to
+		 * report, as they open the files themselves then.
+		 */
+		fd = open(fullpath,
+				  O_WRONLY | O_APPEND | O_CLOEXEC | (create ? O_CREAT : 0),
+				  pg_file_create_mode);
+		if (fd < 0)
+			continue;
+
+		file->fd = fd;
+		file->external_fd = false;
+		file->inherited = true;
+	}
+#endif
+}
+
+/*
+ * is_log_level_output -- is elevel logically >= log_min_level?
+ *
+ * We use this for tests that should consider LOG to sort out-of-order,
+ * between ERROR and FATAL.  Generally this is the right thing for testing
+ * whether a message should go to the postmaster log, whereas a simple >=
+ * test is correct for testing whether the message should go to the client.
+ *
+ * This function is similar to is_log_level_output function in elog.c.
+ */
+static inline bool
+is_log_level_output(int elevel, int log_min_level)
+{
+	if (elevel == LOG || elevel == LOG_SERVER_ONLY)
+	{
+		if (log_min_level == LOG || log_min_level <= ERROR)
+			return true;
+	}
+	else if (elevel == WARNING_CLIENT_ONLY)
+	{
+		/* never sent to log, regardless of log_min_level */
+		return false;
+	}
+	else if (log_min_level == LOG)
+	{
+		/* elevel != LOG */
+		if (elevel >= FATAL)
+			return true;
+	}
+	/* Neither is LOG */
+	else if (elevel >= log_min_level)
+		return true;
+
+	return false;
+}
+
+/*
+ * Checks that the provided log level.
+ */
+static bool
+check_intercept_log_level(int *newval, void **extra, GucSource source)
+{
+	/* Accept 'none'. */
+	if (*newval == LOG_LEVEL_NONE)
+		return true;
+
+	/* We'll lower log_min_messages ourselves, if needed. */
+	if (override_log_min_messages)
+		return true;
+
+	if (!is_log_level_output(*newval, log_min_messages))
+	{
+		GUC_check_errcode(ERRCODE_INVALID_PARAMETER_VALUE);
+		GUC_check_errmsg("cannot set \"pg_intercept_server_logs.log_level\" to more than the level at which server emits logs");
+		GUC_check_errhint("You can increase server's log level by setting \"log_min_messages\" parameter to at least \"pg_intercept_server_logs.log_level\".");
+
+		return false;
+	}
+
+	return true;
+}
+
+static void
+assign_intercept_log_level(int newval, void *extra)
+{
+	intercept_level_mask = log_levels_mask | intercept_level_bits(newval);
+	apply_log_min_messages_override(intercept_level_mask,
+									override_log_min_messages);
+	open_intercept_log_files_in_postmaster(false);
+}
+
+/*
+ * Checks the provided list of log levels and turns it into a mask of levels,
+ * so that intercept_log needs just a bit test to filter messages.
+ */
+static bool
+check_intercept_log_levels(char **newval, void **extra, GucSource source)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *l;
+	uint32		mask = 0;
+	uint32	   *myextra;
+
+	/* Need a modifiable copy of string */
+	rawstring = pstrdup(*newval);
+
+	if (!SplitGUCList(rawstring, ',', &elemlist))
+	{
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+		const struct config_enum_entry *entry;
+
+		for (entry = log_level_options; entry->name != NULL; entry++)
+		{
+			if (pg_strcasecmp(tok, entry->name) == 0)
+				break;
+		}
+
+		if (entry->name == NULL)
+		{
+			GUC_check_errdetail("Unrecognized log level: \"%s\".", tok);
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+
+		/* Accept 'none'. */
+		if (entry->val == LOG_LEVEL_NONE)
+			continue;
+
+		if (!override_log_min_messages &&
+			!is_log_level_output(entry->val, log_min_messages))
+		{
+			GUC_check_errcode(ERRCODE_INVALID_PARAMETER_VALUE);
+			GUC_check_errmsg("cannot set \"pg_intercept_server_logs.log_levels\" to include \"%s\", which is more than the level at which server emits logs",
+							 tok);
+			GUC_check_errhint("You can increase server's log level by setting \"log_min_messages\" parameter to at least \"%s\".",
+							  tok);
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+
+		mask |= intercept_level_bits(entry->val);
+	}
+
+	pfree(rawstring);
+	list_free(elemlist);
+
+	myextra = (uint32 *) intercept_guc_malloc(sizeof(uint32));
+	if (myextra == NULL)
+		return false;
+	*myextra = mask;
+	*extra = (void *) myextra;
+
+	return true;
+}
+
+static void
+assign_intercept_log_levels(const char *newval, void *extra)
+{
+	log_levels_mask = *((uint32 *) extra);
+	intercept_level_mask = log_levels_mask | intercept_level_bits(log_level);
+	apply_log_min_messages_override(intercept_level_mask,
+									override_log_min_messages);
+	open_intercept_log_files_in_postmaster(false);
+}
+
+/*
+ * Turns the list of fields into a mask of INTERCEPT_FIELD_* bits, so that
+ * leaving a field out costs a single test when building the record.
+ */
+static bool
+check_intercept_fields(char **newval, void **extra, GucSource source)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *l;
+	uint32		mask = 0;
+	uint32	   *myextra;
+
+	/* Need a modifiable copy of string */
+	rawstring = pstrdup(*newval);
+
+	if (!SplitGUCList(rawstring, ',', &elemlist))
+	{
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+		int			i;
+
+		for (i = 0; intercept_field_options[i].name != NULL; i++)
+		{
+			if (pg_strcasecmp(tok, intercept_field_options[i].name) == 0)
+				break;
+		}
+
+		if (intercept_field_options[i].name == NULL)
+		{
+			GUC_check_errdetail("Unrecognized field: \"%s\".", tok);
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+
+		mask |= intercept_field_options[i].bits;
+	}
+
+	pfree(rawstring);
+	list_free(elemlist);
+
+	myextra = (uint32 *) intercept_guc_malloc(sizeof(uint32));
+	if (myextra == NULL)
+		return false;
+	*myextra = mask;
+	*extra = (void *) myextra;
+
+	return true;
+}
+
+static void
+assign_intercept_fields(const char *newval, void *extra)
+{
+	intercept_field_mask = *((uint32 *) extra);
+}
+
+/*
+ * Compiles a list of include_patterns or exclude_patterns, see
+ * InterceptPatterns.  Entries between slashes are regular expressions, the
+ * others literal substrings.
+ */
+static bool
+check_intercept_patterns(char **newval, void **extra, const char *name)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *l;
+	List	   *literals = NIL;
+	List	   *regexes = NIL;
+	int			maxstates = 1;
+	int			regexes_len = 0;
+	int			nclasses = 1;
+	uint8		classes[256] = {0};
+	int32	   *next;
+	int32	   *fail;
+	bool	   *accept;
+	int		   *queue;
+	int			nstates = 1;
+	int			head = 0;
+	int			tail = 0;
+	Size		size;
+	InterceptPatterns *patterns;
+	char	   *p;
+	int			i;
+	int			c;
+
+	/* Need a modifiable copy of string */
+	rawstring = pstrdup(*newval);
+
+	if (!split_intercept_guc_list(rawstring, &elemlist))
+	{
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+		int			len = strlen(tok);
+
+		if (len >= 2 && tok[0] == '/' && tok[len - 1] == '/')
+		{
+			regex_t		re;
+			pg_wchar   *wide;
+			int			wide_len;
+			int			rc;
+
+			tok[len - 1] = '\0';
+			tok++;
+			len -= 2;
+
+			wide = palloc((len + 1) * sizeof(pg_wchar));
+			wide_len = pg_mb2wchar_with_len(tok, wide, len);
+			rc = pg_regcomp(&re, wide, wide_len, REG_ADVANCED,
+							C_COLLATION_OID);
+			pfree(wide);
+
+			if (rc != REG_OKAY)
+			{
+				char		errstr[100];
+
+				pg_regerror(rc, &re, errstr, sizeof(errstr));
+				GUC_check_errdetail("Invalid regular expression \"%s\": %s.",
+									tok, errstr);
+				pfree(rawstring);
+				list_free(elemlist);
+				return false;
+			}
+			pg_regfree(&re);
+
+			regexes = lappend(regexes, tok);
+			regexes_len += len + 1;
+		}
+		else
+		{
+			if (len == 0)
+			{
+				GUC_check_errdetail("Empty pattern in \"%s\".", name);
+				pfree(rawstring);
+				list_free(elemlist);
+				return false;
+			}
+
+			literals = lappend(literals, tok);
+			maxstates += len;
+
+			for (i = 0; i < len; i++)
+			{
+				if (classes[(uint8) tok[i]] == 0)
+					classes[(uint8) tok[i]] = nclasses++;
+			}
+		}
+	}
+
+	if (literals == NIL && regexes == NIL)
+	{
+		pfree(rawstring);
+		list_free(elemlist);
+		*extra = NULL;
+		return true;
+	}
+
+	/* Build the trie, -1 standing for a missing transition. */
+	next = palloc(mul_size(maxstates, nclasses * sizeof(int32)));
+	memset(next, -1, mul_size(maxstates, nclasses * sizeof(int32)));
+	fail = palloc0(maxstates * sizeof(int32));
+	accept = palloc0(maxstates * sizeof(bool));
+	queue = palloc(maxstates * sizeof(int));
+
+	foreach(l, literals)
+	{
+		const char *tok = (const char *) lfirst(l);
+		int			state = 0;
+
+		for (; *tok; tok++)
+		{
+			int32	   *slot = &next[state * nclasses + classes[(uint8) *tok]];
+
+			if (*slot < 0)
+				*slot = nstates++;
+			state = *slot;
+		}
+		accept[state] = true;
+	}
+
+	/*
+	 * Fill in the missing transitions from the failure links, breadth first
+	 * so that the link of a state is complete by the time the state is.
+	 */
+	if (literals == NIL)
+		nstates = 0;
+	else
+	{
+		for (c = 0; c < nclasses; c++)
+		{
+			int			s = next[c];
+
+			if (s < 0)
+				next[c] = 0;
+			else
+			{
+				fail[s] = 0;
+				queue[tail++] = s;
+			}
+		}
+
+		while (head < tail)
+		{
+			int			r = queue[head++];
+
+			for (c = 0; c < nclasses; c++)
+			{
+				int			s = next[r * nclasses + c];
+
+				if (s < 0)
+					next[r * nclasses + c] = next[fail[r] * nclasses + c];
+				else
+				{
+					fail[s] = next[fail[r] * nclasses + c];
+					accept[s] |= accept[fail[s]];
+					queue[tail++] = s;
+				}
+			}
+		}
+	}
+
+	size = add_size(offsetof(InterceptPatterns, next),
+					mul_size(nstates, nclasses * sizeof(int32) + sizeof(bool)));
+	size = add_size(size, regexes_len);
+
+	patterns = (InterceptPatterns *) intercept_guc_malloc(size);
+	if (patterns == NULL)
+	{
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	patterns->nstates = nstates;
+	patterns->nclasses = nclasses;
+	patterns->nregexes = list_length(regexes);
+	patterns->regexes_offset = nstates * (nclasses * sizeof(int32) + sizeof(bool));
+	memcpy(patterns->classes, classes, sizeof(classes));
+	memcpy(patterns->next, next, nstates * nclasses * sizeof(int32));
+	memcpy((bool *) INTERCEPT_PATTERNS_ACCEPT(patterns), accept,
+		   nstates * sizeof(bool));
+
+	p = (char *) INTERCEPT_PATTERNS_REGEXES(patterns);
+	foreach(l, regexes)
+	{
+		const char *tok = (const char *) lfirst(l);
+
+		strcpy(p, tok);
+		p += strlen(tok) + 1;
+	}
+
+	pfree(next);
+	pfree(fail);
+	pfree(accept);
+	pfree(queue);
+	list_free(literals);
+	list_free(regexes);
+	pfree(rawstring);
+	list_free(elemlist);
+
+	*extra = (void *) patterns;
+
+	return true;
+}
+
+static bool
+check_intercept_include_patterns(char **newval, void **extra,
+								 GucSource source)
+{
+	return check_intercept_patterns(newval, extra,
+									"pg_intercept_server_logs.include_patterns");
+}
+
+static bool
+check_intercept_exclude_patterns(char **newval, void **extra,
+								 GucSource source)
+{
+	return check_intercept_patterns(newval, extra,
+									"pg_intercept_server_logs.exclude_patterns");
+}
+
+/*
+ * Installs the patterns, compiling their regexes once and for all.  They
+ * were checked to compile already, so failing to now is lack of memory only,
+ * which can't be reported from an assign hook: such a regex never matches.
+ */
+static void
+set_intercept_filter(InterceptFilter *filter, InterceptPatterns *patterns)
+{
+	MemoryContext oldcontext;
+	const char *source;
+	int			i;
+
+	/* Restoring the very same value, for one. */
+	if (filter->patterns == patterns)
+		return;
+
+	if (filter->regexes != NULL)
+	{
+		for (i = 0; i < filter->patterns->nregexes; i++)
+		{
+			if (filter->compiled[i])
+				pg_regfree(&filter->regexes[i]);
+		}
+		pfree(filter->regexes);
+		pfree(filter->compiled);
+		filter->regexes = NULL;
+		filter->compiled = NULL;
+	}
+
+	filter->patterns = patterns;
+
+	if (patterns == NULL || patterns->nregexes == 0)
+		return;
+
+	filter->regexes = MemoryContextAllocExtended(TopMemoryContext,
+												 patterns->nregexes * sizeof(regex_t),
+												 MCXT_ALLOC_NO_OOM);
+	filter->compiled = MemoryContextAllocExtended(TopMemoryContext,
+												  patterns->nregexes * sizeof(bool),
+												  MCXT_ALLOC_NO_OOM | MCXT_ALLOC_ZERO);
+	if (filter->regexes == NULL || filter->compiled == NULL)
+	{
+		if (filter->regexes != NULL)
+			pfree(filter->regexes);
+		if (filter->compiled != NULL)
+			pfree(filter->compiled);
+		filter->regexes = NULL;
+		filter->compiled = NULL;
+		return;
+	}
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	source = INTERCEPT_PATTERNS_REGEXES(patterns);
+	for (i = 0; i < patterns->nregexes; i++)
+	{
+		int			len = strlen(source);
+		pg_wchar   *wide;
+		int			wide_len;
+
+		wide = MemoryContextAllocExtended(TopMemoryContext,
+										  (len + 1) * sizeof(pg_wchar),
+										  MCXT_ALLOC_NO_OOM);
+		if (wide != NULL)
+		{
+			wide_len = pg_mb2wchar_with_len(source, wide, len);
+			filter->compiled[i] = pg_regcomp(&filter->regexes[i], wide,
+											 wide_len, REG_ADVANCED,
+											 C_COLLATION_OID) == REG_OKAY;
+			pfree(wide);
+		}
+
+		source += len + 1;
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static void
+assign_intercept_include_patterns(const char *newval, void *extra)
+{
+	set_intercept_filter(&intercept_include_filter,
+						 (InterceptPatterns *) extra);
+}
+
+static void
+assign_intercept_exclude_patterns(const char *newval, void *extra)
+{
+	set_intercept_filter(&intercept_exclude_filter,
+						 (InterceptPatterns *) extra);
+}
+
+/*
+ * Compiles a list of include_sqlstates or exclude_sqlstates, see
+ * InterceptSqlstates.  Entries are either 5-character SQLSTATEs or
+ * 2-character SQLSTATE classes.
+ */
+static bool
+check_intercept_sqlstates(char **newval, void **extra)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *l;
+	InterceptSqlstates *sqlstates;
+	uint32		size = 1;
+
+	/* Need a modifiable copy of string */
+	rawstring = pstrdup(*newval);
+
+	if (!SplitGUCList(rawstring, ',', &elemlist))
+	{
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	if (elemlist == NIL)
+	{
+		pfree(rawstring);
+		*extra = NULL;
+		return true;
+	}
+
+	/* Keep the set at most half full. */
+	while (size < (uint32) list_length(elemlist) * 2)
+		size <<= 1;
+
+	sqlstates = (InterceptSqlstates *)
+		intercept_guc_malloc(offsetof(InterceptSqlstates, codes) +
+							 size * sizeof(uint32));
+	if (sqlstates == NULL)
+	{
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	memset(sqlstates->classes, 0, sizeof(sqlstates->classes));
+	sqlstates->mask = size - 1;
+	memset(sqlstates->codes, 0xFF, size * sizeof(uint32));
+
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+		int			len = strlen(tok);
+		int			i;
+
+		for (i = 0; i < len; i++)
+		{
+			tok[i] = pg_ascii_toupper((unsigned char) tok[i]);
+			if (!((tok[i] >= '0' && tok[i] <= '9') ||
+				  (tok[i] >= 'A' && tok[i] <= 'Z')))
+				break;
+		}
+
+		if (i < len || (len != 2 && len != 5))
+		{
+			GUC_check_errdetail("Invalid SQLSTATE or SQLSTATE class: \"%s\".",
+								tok);
+			free(sqlstates);
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+
+		if (len == 2)
+		{
+			int			category = MAKE_SQLSTATE(tok[0], tok[1], '0', '0', '0');
+
+			sqlstates->classes[category / 64] |= UINT64CONST(1) << (category % 64);
+		}
+		else
+		{
+			uint32		code = (uint32) MAKE_SQLSTATE(tok[0], tok[1], tok[2],
+													  tok[3], tok[4]);
+			uint32		slot = murmurhash32(code) & sqlstates->mask;
+
+			while (sqlstates->codes[slot] != INTERCEPT_SQLSTATE_EMPTY &&
+				   sqlstates->codes[slot] != code)
+				slot = (slot + 1) & sqlstates->mask;
+			sqlstates->codes[slot] = code;
+		}
+	}
+
+	pfree(rawstring);
+	list_free(elemlist);
+
+	*extra = (void *) sqlstates;
+
+	return true;
+}
+
+static bool
+check_intercept_include_sqlstates(char **newval, void **extra,
+								  GucSource source)
+{
+	return check_intercept_sqlstates(newval, extra);
+}
+
+static bool
+check_intercept_exclude_sqlstates(char **newval, void **extra,
+								  GucSource source)
+{
+	return check_intercept_sqlstates(newval, extra);
+}
+
+static void
+assign_intercept_include_sqlstates(const char *newval, void *extra)
+{
+	intercept_include_sqlstates = (InterceptSqlstates *) extra;
+}
+
+static void
+assign_intercept_exclude_sqlstates(const char *newval, void *extra)
+{
+	intercept_exclude_sqlstates = (InterceptSqlstates *) extra;
+}
+
+/*
+ * Splits rawstring, a comma-separated list, into its elements, which are
+ * pointers into rawstring.  Unlike SplitGUCList, which ends an unquoted
+ * element at the first whitespace, only the whitespace around each element
+ * is dropped, so that 'client backend, autovacuum worker' is two elements.
+ * Elements can still be double-quoted, to take in commas or the whitespace
+ * around them, a double quote being written twice within.  Returns false on
+ * an empty element, an unterminated quote, or text after a closing quote.
+ */
+static bool
+split_intercept_guc_list(char *rawstring, List **namelist)
+{
+	char	   *nextp = rawstring;
+
+	*namelist = NIL;
+
+	while (scanner_isspace(*nextp))
+		nextp++;
+
+	/* Allow an empty list. */
+	if (*nextp == '\0')
+		return true;
+
+	for (;;)
+	{
+		char	   *curname;
+		char	   *endp;
+		bool		done;
+
+		if (*nextp == '"')
+		{
+			/* Quoted element, collapse the doubled quotes within. */
+			curname = endp = ++nextp;
+			for (;;)
+			{
+				if (*nextp == '\0')
+					return false;	/* mismatched quotes */
+				if (*nextp == '"')
+				{
+					if (nextp[1] != '"')
+						break;
+					nextp++;
+				}
+				*endp++ = *nextp++;
+			}
+			nextp++;
+			if (endp == curname)
+				return false;	/* empty quoted element */
+
+			while (scanner_isspace(*nextp))
+				nextp++;
+			if (*nextp != ',' && *nextp != '\0')
+				return false;	/* text after the closing quote */
+		}
+		else
+		{
+			/* Unquoted element, up to the next comma less the whitespace. */
+			curname = nextp;
+			while (*nextp != ',' && *nextp != '\0')
+				nextp++;
+			endp = nextp;
+			while (endp > curname && scanner_isspace(endp[-1]))
+				endp--;
+			if (endp == curname)
+				return false;	/* empty unquoted element */
+		}
+
+		done = (*nextp == '\0');
+		if (!done)
+		{
+			nextp++;
+			while (scanner_isspace(*nextp))
+				nextp++;
+		}
+
+		/* endp may be the comma itself, hence only now. */
+		*endp = '\0';
+		*namelist = lappend(*namelist, curname);
+
+		if (done)
+			break;
+	}
+
+	return true;
+}
+
+/*
+ * Compiles a list of names, see InterceptNameList.  Entries starting with '!'
+ * are excluded.
+ */
+static bool
+check_intercept_name_list(char **newval, void **extra)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *l;
+	InterceptNameList *list;
+	Size		size = offsetof(InterceptNameList, names);
+	char	   *p;
+
+	/* Need a modifiable copy of string */
+	rawstring = pstrdup(*newval);
+
+	if (!split_intercept_guc_list(rawstring, &elemlist))
+	{
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	if (elemlist == NIL)
+	{
+		pfree(rawstring);
+		*extra = NULL;
+		return true;
+	}
+
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+
+		if (tok[0] == '\0' || strcmp(tok, "!") == 0)
+		{
+			GUC_check_errdetail("Empty name.");
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+
+		/* the leading '!' turns into '-', the others get a '+' */
+		size += strlen(tok) + (tok[0] == '!' ? 1 : 2);
+	}
+
+	list = (InterceptNameList *) intercept_guc_malloc(size);
+	if (list == NULL)
+	{
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	list->nnames = list_length(elemlist);
+	list->has_includes = false;
+
+	p = list->names;
+	foreach(l, elemlist)
+	{
+		char	   *tok = (char *) lfirst(l);
+
+		if (tok[0] == '!')
+		{
+			*p++ = '-';
+			tok++;
+		}
+		else
+		{
+			*p++ = '+';
+			list->has_includes = true;
+		}
+
+		strcpy(p, tok);
+		p += strlen(tok) + 1;
+	}
+
+	pfree(rawstring);
+	list_free(elemlist);
+
+	*extra = (void *) list;
+
+	return true;
+}
+
+static bool
+check_intercept_backend_types(char **newval, void **extra, GucSource source)
+{
+	return check_intercept_name_list(newval, extra);
+}
+
+static bool
+check_intercept_databases(char **newval, void **extra, GucSource source)
+{
+	return check_intercept_name_list(newval, extra);
+}
+
+static bool
+check_intercept_roles(char **newval, void **extra, GucSource source)
+{
+	return check_intercept_name_list(newval, extra);
+}
+
+static bool
+check_intercept_application_names(char **newval, void **extra,
+								  GucSource source)
+{
+	return check_intercept_name_list(newval, extra);
+}
+
+static void
+assign_intercept_backend_types(const char *newval, void *extra)
+{
+	intercept_backend_types = (InterceptNameList *) extra;
+	intercept_process_verdict.pid = 0;
+}
+
+static void
+assign_intercept_databases(const char *newval, void *extra)
+{
+	intercept_databases = (InterceptNameList *) extra;
+	intercept_process_verdict.pid = 0;
+}
+
+static void
+assign_intercept_roles(const char *newval, void *extra)
+{
+	intercept_roles = (InterceptNameList *) extra;
+	intercept_process_verdict.pid = 0;
+}
+
+static void
+assign_intercept_application_names(const char *newval, void *extra)
+{
+	intercept_application_names = (InterceptNameList *) extra;
+	intercept_process_verdict.pid = 0;
+}
+
+static bool
+check_intercept_locations(char **newval, void **extra, GucSource source)
+{
+	return check_intercept_name_list(newval, extra);
+}
+
+static void
+assign_intercept_locations(const char *newval, void *extra)
+{
+	intercept_locations = (InterceptNameList *) extra;
+
+	/* The cached verdicts are of the former list. */
+	if (intercept_location_cache != NULL)
+		clear_intercept_hash(intercept_location_cache);
+	intercept_last_location.funcname = NULL;
+	intercept_last_location.filename = NULL;
+}
+
+/*
+ * Gets the bits of the levels that get intercepted when elevel is asked for,
+ * that is, elevel and the levels that share its severity name.
+ */
+static inline uint32
+intercept_level_bits(int elevel)
+{
+	if (elevel == LOG_LEVEL_NONE)
+		return 0;
+	if (elevel == LOG)
+		return INTERCEPT_LEVEL_BIT(LOG) | INTERCEPT_LEVEL_BIT(LOG_SERVER_ONLY);
+	if (elevel == WARNING)
+		return INTERCEPT_LEVEL_BIT(WARNING) |
+			INTERCEPT_LEVEL_BIT(WARNING_CLIENT_ONLY);
+
+	return INTERCEPT_LEVEL_BIT(elevel);
+}
+
+static void
+assign_override_log_min_messages(bool newval, void *extra)
+{
+	apply_log_min_messages_override(intercept_level_mask, newval);
+}
+
+/*
+ * Gets the highest log_min_messages that lets the server emit both the
+ * messages it emits with log_min_level and the messages of elevel.
+ */
+static int
+lower_log_min_level(int log_min_level, int elevel)
+{
+	if (is_log_level_output(elevel, log_min_level))
+		return log_min_level;
+
+	/* LOG sorts between ERROR and FATAL, see is_log_level_output. */
+	if (elevel == LOG || elevel == LOG_SERVER_ONLY)
+		return LOG;
+
+	return elevel;
+}
+
+/*
+ * Gets the log_min_messages that lets the server emit the messages of the
+ * levels in level_mask along with those it's configured to, if override.
+ */
+static int
+get_lowered_log_min_messages(int configured, uint32 level_mask, bool override)
+{
+	int			lowered = configured;
+	int			elevel;
+
+	if (override)
+	{
+		for (elevel = DEBUG5; elevel <= PANIC; elevel++)
+		{
+			if (level_mask & INTERCEPT_LEVEL_BIT(elevel))
+				lowered = lower_log_min_level(lowered, elevel);
+		}
+	}
+
+	return lowered;
+}
+
+/*
+ * Check hook that we put on log_min_messages.  Whatever sets it, SET, RESET,
+ * or reloading the configuration file in any process, gets the lowered value
+ * in place of the configured one, which is handed to our assign hook as the
+ * extra.  Otherwise a reload would put back the configured value, and the
+ * processes that neither end transactions nor emit messages at that level
+ * would stop intercepting for good.
+ */
+static bool
+check_log_min_messages(int *newval, void **extra, GucSource source)
+{
+	int		   *myextra;
+
+	if (prev_log_min_messages_check_hook &&
+		!prev_log_min_messages_check_hook(newval, extra, source))
+		return false;
+
+	myextra = (int *) intercept_guc_malloc(sizeof(int));
+	if (myextra == NULL)
+		return false;
+	*myextra = *newval;
+	*extra = (void *) myextra;
+
+	*newval = get_lowered_log_min_messages(*newval, intercept_level_mask,
+										   override_log_min_messages);
+
+	return true;
+}
+
+/*
+ * Assign hook that we put on log_min_messages, see check_log_min_messages.
+ * The values that didn't go through our check hook, those set before we were
+ * loaded, come without an extra: they are the configured values.
+ */
+static void
+assign_log_min_messages(int newval, void *extra)
+{
+	admin_log_min_messages = extra ? *((int *) extra) : newval;
+	lowered_log_min_messages = newval;
+	log_min_messages_lowered = (newval != admin_log_min_messages);
+
+	if (prev_log_min_messages_assign_hook)
+		prev_log_min_messages_assign_hook(newval, extra);
+}
+
+/*
+ * Puts our check and assign hooks on log_min_messages, chaining to any that
+ * are there.  The server offers no other way to hear of the configuration
+ * file being reloaded.
+ */
+static void
+hook_log_min_messages(void)
+{
+	struct config_enum *conf = NULL;
+
+#if PG_VERSION_NUM >= 160000
+	struct config_generic *gconf = find_option("log_min_messages", false,
+											   true, LOG);
+
+	if (gconf != NULL && gconf->vartype == PGC_ENUM)
+		conf = (struct config_enum *) gconf;
+#else
+	struct config_generic **gucs = get_guc_variables();
+	int			nguc = GetNumConfigOptions();
+	int			i;
+
+	for (i = 0; i < nguc; i++)
+	{
+		if (gucs[i]->vartype == PGC_ENUM &&
+			strcmp(gucs[i]->name, "log_min_messages") == 0)
+		{
+			conf = (struct config_enum *) gucs[i];
+			break;
+		}
+	}
+#endif
+
+	/* Loaded twice, say, by LOAD after shared_preload_libraries? */
+	if (conf == NULL || conf->check_hook == check_log_min_messages)
+		return;
+
+	prev_log_min_messages_check_hook = conf->check_hook;
+	prev_log_min_messages_assign_hook = conf->assign_hook;
+	conf->check_hook = check_log_min_messages;
+	conf->assign_hook = assign_log_min_messages;
+}
+
+/*
+ * Lowers log_min_messages so that the server emits the messages of the levels
+ * in level_mask, or puts back the configured log_min_messages if there's no
+ * need to lower it.
+ *
+ * This is for when our own settings change.  log_min_messages is set directly
+ * rather than via the GUC machinery, so that it still reports the value the
+ * server was configured with as its source.  A value we didn't put there is
+ * taken as the newly configured one, in case it got set without going
+ * through check_log_min_messages.
+ */
+static void
+apply_log_min_messages_override(uint32 level_mask, bool override)
+{
+	int			new_log_min_messages;
+
+	if (!log_min_messages_lowered ||
+		log_min_messages != lowered_log_min_messages)
+		admin_log_min_messages = log_min_messages;
+
+	new_log_min_messages = get_lowered_log_min_messages(admin_log_min_messages,
+														level_mask, override);
+
+	log_min_messages = new_log_min_messages;
+	lowered_log_min_messages = new_log_min_messages;
+	log_min_messages_lowered =
+		(new_log_min_messages != admin_log_min_messages);
+}
+
+/*
+ * Does name, NULL if unknown, pass the list?  That is, does it match one of
+ * the included names, if there are any, and none of the excluded ones.
+ */
+static bool
+intercept_name_list_allows(InterceptNameList *list, const char *name,
+						   bool case_insensitive)
+{
+	const char *p = list->names;
+	bool		included = !list->has_includes;
+	int			i;
+
+	for (i = 0; i < list->nnames; i++)
+	{
+		bool		matches;
+
+		matches = name != NULL &&
+			(case_insensitive ? pg_strcasecmp(p + 1, name) :
+			 strcmp(p + 1, name)) == 0;
+
+		if (matches)
+		{
+			if (p[0] == '-')
+				return false;
+			included = true;
+		}
+
+		p += strlen(p) + 1;
+	}
+
+	return included;
+}
+
+/*
+ * Does the database or role of the given name and OID pass the list?  Like
+ * intercept_name_list_allows, except that the entries made of digits only
+ * are OIDs, matched against oid.  name is known only to the processes
+ * serving a client connection, while oid is to any process connected to a
+ * database, autovacuum workers among them.
+ */
+static bool
+intercept_object_list_allows(InterceptNameList *list, const char *name,
+							 Oid oid)
+{
+	const char *p = list->names;
+	bool		included = !list->has_includes;
+	int			i;
+
+	for (i = 0; i < list->nnames; i++)
+	{
+		const char *entry = p + 1;
+		bool		matches;
+
+		if (strspn(entry, "0123456789") == strlen(entry))
+			matches = OidIsValid(oid) && atooid(entry) == oid;
+		else
+			matches = name != NULL && strcmp(entry, name) == 0;
+
+		if (matches)
+		{
+			if (p[0] == '-')
+				return false;
+			included = true;
+		}
+
+		p += strlen(p) + 1;
+	}
+
+	return included;
+}
+
+/*
+ * Works out whether this process's messages are wanted, as per backend_types,
+ * databases, roles and application_names, for intercept_process_wanted to
+ * cache.  databases and roles apply only to the processes connected to a
+ * database, or to a role, see intercept_object_list_allows.
+ */
+static void
+compute_intercept_process_verdict(void)
+{
+	InterceptProcessVerdict *verdict = &intercept_process_verdict;
+	const char *backend_type;
+	bool		wanted = true;
+
+	verdict->pid = MyProcPid;
+	verdict->database_id = MyDatabaseId;
+	verdict->role_id = INTERCEPT_MY_ROLE_ID();
+	verdict->database_name = MyProcPort ? MyProcPort->database_name : NULL;
+	verdict->application_name = application_name;
+	strlcpy(verdict->application_name_copy,
+			application_name ? application_name : "", NAMEDATALEN);
+
+	if (intercept_backend_types != NULL)
+	{
+		/* Background workers say what kind they are, as in elog.c. */
+		if (MyBackendType == B_BG_WORKER && MyBgworkerEntry)
+			backend_type = MyBgworkerEntry->bgw_type;
+		else
+			backend_type = GetBackendTypeDesc(MyBackendType);
+
+		wanted = intercept_name_list_allows(intercept_backend_types,
+											backend_type, true);
+	}
+
+	if (wanted && intercept_databases != NULL &&
+		(OidIsValid(verdict->database_id) || MyProcPort != NULL))
+		wanted = intercept_object_list_allows(intercept_databases,
+											  MyProcPort ? MyProcPort->database_name : NULL,
+											  verdict->database_id);
+
+	if (wanted && intercept_roles != NULL &&
+		(OidIsValid(verdict->role_id) || MyProcPort != NULL))
+		wanted = intercept_object_list_allows(intercept_roles,
+											  MyProcPort ? MyProcPort->user_name : NULL,
+											  verdict->role_id);
+
+	if (wanted && intercept_application_names != NULL)
+		wanted = intercept_name_list_allows(intercept_application_names,
+											verdict->application_name_copy,
+											false);
+
+	verdict->wanted = wanted;
+}
+
+/*
+ * Are this process's messages wanted?  The verdict is worked out again only
+ * when the settings or the process's identity change.
+ *
+ * application_name being set to a new value allocates it anew, so that
+ * comparing pointers is enough, except that a pointer may come back after two
+ * changes: its value is compared too when it matters.
+ */
+static inline bool
+intercept_process_wanted(void)
+{
+	InterceptProcessVerdict *verdict = &intercept_process_verdict;
+
+	if (unlikely(verdict->pid != MyProcPid ||
+				 verdict->database_id != MyDatabaseId ||
+				 verdict->role_id != INTERCEPT_MY_ROLE_ID() ||
+				 verdict->database_name !=
+				 (MyProcPort ? MyProcPort->database_name : NULL) ||
+				 verdict->application_name != application_name ||
+				 (intercept_application_names != NULL &&
+				  strncmp(verdict->application_name_copy,
+						  application_name ? application_name : "",
+						  NAMEDATALEN - 1) != 0)))
+		compute_intercept_process_verdict();
+
+	return verdict->wanted;
+}
+
+/*
+ * Works out whether the messages from the given function of the given file
+ * pass locations: the names containing a dot are of files, the others of
+ * functions.
+ */
+static bool
+compute_intercept_location_verdict(const char *funcname, const char *filename)
+{
+	InterceptNameList *list = intercept_locations;
+	const char *p = list->names;
+	bool		included = !list->has_includes;
+	int			i;
+
+	for (i = 0; i < list->nnames; i++)
+	{
+		const char *name = strchr(p + 1, '.') ? filename : funcname;
+
+		if (name != NULL && strcmp(p + 1, name) == 0)
+		{
+			if (p[0] == '-')
+				return false;
+			included = true;
+		}
+
+		p += strlen(p) + 1;
+	}
+
+	return included;
+}
+
+/*
+ * Do the messages from the given function of the given file pass locations?
+ * The last location seen is tried first, then the cache of verdicts, and the
+ * names get compared only on first sight of a location.  The verdict is
+ * computed every time for the locations that find no room in the cache.
+ */
+static inline bool
+intercept_location_wanted(const char *funcname, const char *filename)
+{
+	InterceptLocationEntry *entry;
+	InterceptLocationKey key;
+	bool		found;
+
+	if (intercept_last_location.funcname == funcname &&
+		intercept_last_location.filename == filename &&
+		funcname != NULL)
+		return intercept_last_location_wanted;
+
+	/* Zero out the padding, if any, the key being hashed as bytes. */
+	memset(&key, 0, sizeof(key));
+	key.funcname = funcname;
+	key.filename = filename;
+
+	entry = (InterceptLocationEntry *) hash_search(intercept_location_cache,
+												   &key, HASH_FIND, &found);
+	if (entry == NULL)
+	{
+		if (hash_get_num_entries(intercept_location_cache) >=
+			INTERCEPT_LOCATION_CACHE_SIZE)
+			return compute_intercept_location_verdict(funcname, filename);
+
+		entry = (InterceptLocationEntry *) hash_search(intercept_location_cache,
+													   &key, HASH_ENTER_NULL,
+													   &found);
+		if (entry == NULL)
+			return compute_intercept_location_verdict(funcname, filename);
+	}
+
+	if (!found)
+		entry->wanted = compute_intercept_location_verdict(funcname, filename);
+
+	intercept_last_location = key;
+	intercept_last_location_wanted = entry->wanted;
+
+	return entry->wanted;
+}
+
+/*
+ * Is sqlerrcode, or its class, in the set?
+ */
+static inline bool
+intercept_sqlstate_matches(InterceptSqlstates *sqlstates, int sqlerrcode)
+{
+	int			category = ERRCODE_TO_CATEGORY(sqlerrcode);
+	uint32		code = (uint32) sqlerrcode;
+	uint32		slot;
+
+	if (sqlstates->classes[category / 64] & (UINT64CONST(1) << (category % 64)))
+		return true;
+
+	for (slot = murmurhash32(code) & sqlstates->mask;
+		 sqlstates->codes[slot] != INTERCEPT_SQLSTATE_EMPTY;
+		 slot = (slot + 1) & sqlstates->mask)
+	{
+		if (sqlstates->codes[slot] == code)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Does the message, of len bytes, match any of the filter's patterns?  The
+ * literals are tried first, in a single pass over the message, the regexes
+ * only if none of them matches.
+ */
+static bool
+intercept_filter_matches(InterceptFilter *filter, const char *message,
+						 int len)
+{
+	InterceptPatterns *patterns = filter->patterns;
+	static pg_wchar *wide = NULL;
+	pg_wchar   *buf;
+	int			wide_len;
+	bool		matched = false;
+	int			i;
+
+	if (patterns->nstates > 0)
+	{
+		const bool *accept = INTERCEPT_PATTERNS_ACCEPT(patterns);
+		const int32 *next = patterns->next;
+		int			nclasses = patterns->nclasses;
+		int32		state = 0;
+
+		for (i = 0; i < len; i++)
+		{
+			state = next[state * nclasses +
+						 patterns->classes[(uint8) message[i]]];
+			if (accept[state])
+				return true;
+		}
+	}
+
+	if (filter->regexes == NULL)
+		return false;
+
+	/*
+	 * The regex engine wants wide characters.  Keep a buffer for them, but
+	 * not one as big as the longest message ever seen.
+	 */
+	if (len < INTERCEPT_FILTER_WIDE_SIZE)
+	{
+		if (wide == NULL)
+			wide = MemoryContextAllocExtended(TopMemoryContext,
+											  INTERCEPT_FILTER_WIDE_SIZE * sizeof(pg_wchar),
+											  MCXT_ALLOC_NO_OOM);
+		buf = wide;
+	}
+	else if ((Size) len < MaxAllocSize / sizeof(pg_wchar))
+		buf = MemoryContextAllocExtended(TopMemoryContext,
+										 (len + 1) * sizeof(pg_wchar),
+										 MCXT_ALLOC_NO_OOM);
+	else
+		buf = NULL;
+	if (buf == NULL)
+		return false;
+	wide_len = pg_mb2wchar_with_len(message, buf, len);
+
+	/*
+	 * The regex engine checks for interrupts, which mustn't be serviced, and
+	 * possibly raise an error, in the middle of emitting a message.
+	 */
+	HOLD_INTERRUPTS();
+	for (i = 0; i < patterns->nregexes && !matched; i++)
+	{
+		if (filter->compiled[i])
+			matched = pg_regexec(&filter->regexes[i], buf, wide_len, 0,
+								 NULL, 0, NULL, 0) == REG_OKAY;
+	}
+	RESUME_INTERRUPTS();
+
+	if (buf != wide)
+		pfree(buf);
+
+	return matched;
+}
+
+/*
+ * Does the message pass locations, the SQLSTATE filters, and then
+ * include_patterns and exclude_patterns?
+ */
+static inline bool
+intercept_message_wanted(ErrorData *edata)
+{
+	const char *message;
+	int			len;
+
+	if (intercept_locations != NULL &&
+		!intercept_location_wanted(edata->funcname, edata->filename))
+		return false;
+
+	if (intercept_include_sqlstates != NULL &&
+		!intercept_sqlstate_matches(intercept_include_sqlstates,
+									edata->sqlerrcode))
+		return false;
+
+	if (intercept_exclude_sqlstates != NULL &&
+		intercept_sqlstate_matches(intercept_exclude_sqlstates,
+								   edata->sqlerrcode))
+		return false;
+
+	if (intercept_include_filter.patterns == NULL &&
+		intercept_exclude_filter.patterns == NULL)
+		return true;
+
+	message = edata->message ? edata->message : "";
+	len = strlen(message);
+
+	if (intercept_include_filter.patterns != NULL &&
+		!intercept_filter_matches(&intercept_include_filter, message, len))
+		return false;
+
+	if (intercept_exclude_filter.patterns != NULL &&
+		intercept_filter_matches(&intercept_exclude_filter, message, len))
+		return false;
+
+	return true;
+}
+
+/*
+ * Hashes the message's template, that is where it was raised from and its
+ * untranslated format string.  The strings are hashed rather than their
+ * addresses, which may differ between processes for the libraries loaded by
+ * each of them.  Never returns 0, see InterceptRateBucket.key.
+ */
+static uint64
+intercept_message_template_hash(ErrorData *edata)
+{
+	uint64		hash = (uint64) edata->lineno;
+
+	if (edata->filename)
+		hash = hash_bytes_extended((const unsigned char *) edata->filename,
+								   strlen(edata->filename), hash);
+	if (edata->message_id)
+		hash = hash_bytes_extended((const unsigned char *) edata->message_id,
+								   strlen(edata->message_id), hash);
+
+	return hash != 0 ? hash : 1;
+}
+
+/*
+ * Makes the bucket that of the template hashed as key, full.  The caller
+ * holds the bucket's mutex.  Timestamping it right away keeps it from being
+ * taken over again before it's even used.
+ */
+static void
+claim_intercept_rate_bucket(InterceptRateBucket *bucket, uint64 key,
+							ErrorData *edata, TimestampTz now)
+{
+	pg_atomic_write_u64(&bucket->key, key);
+	bucket->tokens = Max(rate_limit_burst, 1);
+	bucket->last_refill = now;
+	bucket->suppressed = 0;
+	bucket->lineno = edata->lineno;
+	strlcpy(bucket->filename, edata->filename ? edata->filename : "?",
+			sizeof(bucket->filename));
+}
+
+/*
+ * Finds the bucket of the template hashed as key, claiming a free one or
+ * one that has been idle long enough if it has none.  Returns NULL if the
+ * buckets it could go into are all taken, the template then goes unlimited.
+ */
+static InterceptRateBucket *
+get_intercept_rate_bucket(uint64 key, ErrorData *edata, TimestampTz now)
+{
+	InterceptRateBucket *buckets = intercept_shared->rate_buckets;
+	uint32		start = (uint32) key;
+	int			i;
+
+	for (i = 0; i < INTERCEPT_RATE_PROBES; i++)
+	{
+		InterceptRateBucket *bucket =
+			&buckets[(start + i) & (INTERCEPT_RATE_BUCKETS - 1)];
+		uint64		current = pg_atomic_read_u64(&bucket->key);
+		bool		found = false;
+
+		if (current == key)
+			return bucket;
+
+		if (current != 0)
+			continue;
+
+		SpinLockAcquire(&bucket->mutex);
+		current = pg_atomic_read_u64(&bucket->key);
+		if (current == 0)
+			claim_intercept_rate_bucket(bucket, key, edata, now);
+		found = (current == 0 || current == key);
+		SpinLockRelease(&bucket->mutex);
+
+		if (found)
+			return bucket;
+	}
+
+	for (i = 0; i < INTERCEPT_RATE_PROBES; i++)
+	{
+		InterceptRateBucket *bucket =
+			&buckets[(start + i) & (INTERCEPT_RATE_BUCKETS - 1)];
+		bool		reclaimed = false;
+
+		SpinLockAcquire(&bucket->mutex);
+		if (bucket->suppressed == 0 &&
+			TimestampDifferenceExceeds(bucket->last_refill, now,
+									   INTERCEPT_RATE_IDLE * 1000))
+		{
+			claim_intercept_rate_bucket(bucket, key, edata, now);
+			reclaimed = true;
+		}
+		SpinLockRelease(&bucket->mutex);
+
+		if (reclaimed)
+			return bucket;
+	}
+
+	return NULL;
+}
+
+/*
+ * Takes a token from the bucket of the message's template, as per rate_limit
+ * and rate_limit_burst.  Returns false if there's none left, in which case
+ * the message is to be suppressed.  Otherwise, *suppressed is set to the
+ * number of messages of the template suppressed since the last one let
+ * through.
+ */
+static bool
+intercept_rate_limit_allows(ErrorData *edata, uint64 *suppressed)
+{
+	uint64		key = intercept_message_template_hash(edata);
+	TimestampTz now = GetCurrentTimestamp();
+	InterceptRateBucket *bucket;
+	double		burst = Max(rate_limit_burst, 1);
+	bool		allowed = true;
+
+	*suppressed = 0;
+
+	bucket = get_intercept_rate_bucket(key, edata, now);
+	if (bucket == NULL)
+		return true;
+
+	SpinLockAcquire(&bucket->mutex);
+
+	/* Someone may have reclaimed the bucket meanwhile. */
+	if (pg_atomic_read_u64(&bucket->key) == key)
+	{
+		if (now > bucket->last_refill)
+			bucket->tokens = Min(burst, bucket->tokens +
+								 (double) (now - bucket->last_refill) *
+								 rate_limit / USECS_PER_SEC);
+		bucket->last_refill = now;
+
+		if (bucket->tokens >= 1)
+		{
+			bucket->tokens -= 1;
+			*suppressed = bucket->suppressed;
+			bucket->suppressed = 0;
+		}
+		else
+		{
+			bucket->suppressed++;
+			bucket->elevel = edata->elevel;
+			bucket->sqlerrcode = edata->sqlerrcode;
+			allowed = false;
+		}
+	}
+
+	SpinLockRelease(&bucket->mutex);
+
+	if (!allowed)
+		pg_atomic_fetch_add_u64(&intercept_shared->suppressed_messages, 1);
+
+	return allowed;
+}
+
+/*
+ * Emits a record telling that suppressed messages of the template of edata
+ * were suppressed by rate_limit, ahead of edata itself.
+ */
+static void
+emit_intercept_suppressed_summary(ErrorData *edata, uint64 suppressed)
+{
+	ErrorData	summary = *edata;
+	char		message[MAXPGPATH + 128];
+
+	snprintf(message, sizeof(message),
+			 "rate limiting suppressed %llu messages raised at %s:%d",
+			 (unsigned long long) suppressed,
+			 edata->filename ? edata->filename : "?", edata->lineno);
+
+	summary.message = message;
+	summary.detail = NULL;
+	summary.detail_log = NULL;
+	summary.hint = NULL;
+	summary.context = NULL;
+	summary.backtrace = NULL;
+	summary.internalquery = NULL;
+	summary.cursorpos = 0;
+	summary.internalpos = 0;
+
+	prepare_and_emit_intercept_log_message(&summary);
+}
+
+/*
+ * Writes out the summaries of the suppressed messages whose storm is over,
+ * that is whose template would have its next message let through, or of all
+ * of them if all is set.  Otherwise a summary waits for that next message,
+ * which may never come.  The writer and retention workers call this
+ * periodically, and the processes that got messages suppressed at exit.
+ */
+static void
+flush_intercept_suppressed_summaries(bool all)
+{
+	TimestampTz now;
+	int			i;
+
+	if (intercept_shared == NULL || in_intercept_log_hook)
+		return;
+
+	now = GetCurrentTimestamp();
+
+	in_intercept_log_hook = true;
+
+	for (i = 0; i < INTERCEPT_RATE_BUCKETS; i++)
+	{
+		InterceptRateBucket *bucket = &intercept_shared->rate_buckets[i];
+		ErrorData	edata;
+		char		filename[NAMEDATALEN];
+		uint64		suppressed = 0;
+
+		/* Most buckets have nothing pending, don't lock them all. */
+		if (bucket->suppressed == 0)
+			continue;
+
+		memset(&edata, 0, sizeof(edata));
+
+		SpinLockAcquire(&bucket->mutex);
+		if (bucket->suppressed > 0 &&
+			(all || rate_limit <= 0 ||
+			 bucket->tokens + (double) (now - bucket->last_refill) *
+			 rate_limit / USECS_PER_SEC >= 1))
+		{
+			suppressed = bucket->suppressed;
+			bucket->suppressed = 0;
+			edata.elevel = bucket->elevel;
+			edata.sqlerrcode = bucket->sqlerrcode;
+			edata.lineno = bucket->lineno;
+			memcpy(filename, bucket->filename, sizeof(filename));
+		}
+		SpinLockRelease(&bucket->mutex);
+
+		if (suppressed == 0)
+			continue;
+
+		edata.output_to_server = true;
+		edata.hide_stmt = true;
+		edata.hide_ctx = true;
+		edata.filename = filename;
+		emit_intercept_suppressed_summary(&edata, suppressed);
+	}
+
+	flush_intercept_log_buffers();
+
+	in_intercept_log_hook = false;
+}
+
+/*
+ * Writes the message out, unless rate_limit says to suppress it.
+ */
+static void
+emit_intercept_log_message_rate_limited(ErrorData *edata)
+{
+	uint64		suppressed;
+
+	/*
+	 * The postmaster doesn't rely on the shared memory being sane, and it
+	 * isn't there without shared_preload_libraries.
+	 */
+	if (rate_limit > 0 && intercept_shared != NULL && IsUnderPostmaster)
+	{
+		if (!intercept_rate_limit_allows(edata, &suppressed))
+			return;
+
+		if (suppressed > 0)
+			emit_intercept_suppressed_summary(edata, suppressed);
+	}
+
+	prepare_and_emit_intercept_log_message(edata);
+}
+
+/*
+ * Implements emit_log_hook for this module.
+ */
+static void
+intercept_log(ErrorData *edata)
+{
+	/* Any other plugins which use emit_log_hook. */
+	if (original_emit_log_hook)
+		original_emit_log_hook(edata);
+
+	/*
+	 * Keep the messages that the server emits only because we lowered
+	 * log_min_messages out of the server log.  Pick up the configured value
+	 * first, in case it was changed since we lowered it.
+	 */
+	if (override_log_min_messages &&
+		log_min_messages != lowered_log_min_messages)
+		apply_log_min_messages_override(intercept_level_mask,
+										override_log_min_messages);
+
+	if (log_min_messages_lowered &&
+		!is_log_level_output(edata->elevel, admin_log_min_messages))
+		edata->output_to_server = false;
+
+	/* Let's not recursively call the intercept_log hook. */
+	if (in_intercept_log_hook)
+		return;
+
+	/* Nothing to do if the level isn't asked for. */
+	if ((intercept_level_mask & INTERCEPT_LEVEL_BIT(edata->elevel)) == 0)
+		return;
+
+	/* Nor if the process isn't. */
+	if (!intercept_process_wanted())
+		return;
+
+	in_intercept_log_hook = true;
+
+	/* Nor if the message doesn't pass the filters. */
+	if (intercept_message_wanted(edata))
+		emit_intercept_log_message_rate_limited(edata);
+
+	in_intercept_log_hook = false;
+}
+
+/*
+ * Gets string representing elevel.
+ *
+ * This function is similar to error_severity function in elog.c except that
+ * it gives separate DEBUGX as prefix as opposed to error_severity giving prefix
+ * DEBUG for all DEBUGX levels.
+ */
+static const char *
+intercept_log_severity(int elevel)
+{
+	const char *prefix;
+
+	switch (elevel)
+	{
+		case DEBUG1:
+			prefix = gettext_noop("DEBUG1");
+			break;
+		case DEBUG2:
+			prefix = gettext_noop("DEBUG2");
+			break;
+		case DEBUG3:
+			prefix = gettext_noop("DEBUG3");
+			break;
+		case DEBUG4:
+			prefix = gettext_noop("DEBUG4");
+			break;
+		case DEBUG5:
+			prefix = gettext_noop("DEBUG5");
+			break;
+		case LOG:
+		case LOG_SERVER_ONLY:
+			prefix = gettext_noop("LOG");
+			break;
+		case INFO:
+			prefix = gettext_noop("INFO");
+			break;
+		case NOTICE:
+			prefix = gettext_noop("NOTICE");
+			break;
+		case WARNING:
+		case WARNING_CLIENT_ONLY:
+			prefix = gettext_noop("WARNING");
+			break;
+		case ERROR:
+			prefix = gettext_noop("ERROR");
+			break;
+		case FATAL:
+			prefix = gettext_noop("FATAL");
+			break;
+		case PANIC:
+			prefix = gettext_noop("PANIC");
+			break;
+		default:
+			prefix = "???";
+			break;
+	}
+
+	return prefix;
+}
+
+/*
+ * Formats the time *tv stands for into formatted_log_time.
+ *
+ * Everything but the milliseconds is formatted just once per second, the
+ * timezone conversion being the expensive part.
+ */
+static void
+format_intercept_log_time(char *formatted_log_time, const struct timeval *tv)
+{
+	static char cached_log_time[FORMATTED_TS_LEN];
+	static pg_time_t cached_stamp_time = -1;
+	static pg_tz *cached_log_timezone = NULL;
+	pg_time_t	stamp_time;
+	int			msec;
+
+	stamp_time = (pg_time_t) tv->tv_sec;
+
+	if (stamp_time != cached_stamp_time ||
+		log_timezone != cached_log_timezone)
+	{
+		/*
+		 * Note: we expect that guc.c will ensure that log_timezone is set up
+		 * (at least with a minimal GMT value).
+		 */
+		pg_strftime(cached_log_time, FORMATTED_TS_LEN,
+		/* leave room for milliseconds... */
+					"%Y-%m-%d %H:%M:%S     %Z",
+					pg_localtime(&stamp_time, log_timezone));
+
+		cached_stamp_time = stamp_time;
+		cached_log_timezone = log_timezone;
+	}
+
+	strlcpy(formatted_log_time, cached_log_time, FORMATTED_TS_LEN);
+
+	/* 'paste' milliseconds into place... */
+	msec = (int) (tv->tv_usec / 1000);
+	formatted_log_time[19] = '.';
+	formatted_log_time[20] = '0' + msec / 100;
+	formatted_log_time[21] = '0' + (msec / 10) % 10;
+	formatted_log_time[22] = '0' + msec % 10;
+}
+
+/*
+ *	Appends the string to the StringInfo buffer, inserting a tab after any
+ *	newline.
+ *
+ *	Statements and backtraces can be kilobytes long, so rather than going
+ *	character by character, the runs between newlines are found with memchr,
+ *	which the C library implements with wide vector loads, and copied in bulk.
+ */
+static void
+append_with_tabs_len(StringInfo buf, const char *str, size_t len)
+{
+	const char *end = str + len;
+	const char *nl;
+
+	/* Make room for the whole string up front, tabs aside. */
+	enlargeStringInfo(buf, (int) len);
+
+	while ((nl = memchr(str, '\n', end - str)) != NULL)
+	{
+		appendBinaryStringInfo(buf, str, (int) (nl - str + 1));
+		appendStringInfoCharMacro(buf, '\t');
+		str = nl + 1;
+	}
+
+	appendBinaryStringInfo(buf, str, (int) (end - str));
+}
+
+#define append_with_tabs(buf, str) \
+	append_with_tabs_len((buf), (str), strlen(str))
+
+/*
+ * Pads what was appended to the buffer since start with spaces as per
+ * padding, which is as in log_line_prefix: right-aligned if positive,
+ * left-aligned if negative.
+ */
+static void
+pad_from(StringInfo buf, int start, int padding)
+{
+	int			len = buf->len - start;
+	int			width = Abs(padding);
+
+	if (padding == 0 || len >= width)
+		return;
+
+	if (padding < 0)
+	{
+		appendStringInfoSpaces(buf, width - len);
+		return;
+	}
+
+	enlargeStringInfo(buf, width - len);
+	memmove(buf->data + start + width - len, buf->data + start, len);
+	memset(buf->data + start, ' ', width - len);
+	buf->len += width - len;
+	buf->data[buf->len] = '\0';
+}
+
+/*
+ * Appends the lowercase hexadecimal representation of value, without going
+ * through printf.
+ */
+static void
+append_hex(StringInfo buf, uint64 value)
+{
+	static const char hex[] = "0123456789abcdef";
+	char		digits[16];
+	int			i = lengthof(digits);
+
+	do
+	{
+		digits[--i] = hex[value & 0x0f];
+		value >>= 4;
+	} while (value != 0);
+
+	appendBinaryStringInfo(buf, digits + i, lengthof(digits) - i);
+}
+
+/*
+ * Renders the parts of the prefix that come from the record's backend.
+ */
+static void
+render_prefix_constants(InterceptPrefixConstants *constants,
+						InterceptLogRecord *record)
+{
+	constants->pid = record->pid;
+	constants->pid_len = pg_ltoa(record->pid, constants->pid_str);
+	constants->user_name = record->user_name;
+	constants->user_name_len =
+		record->user_name ? (int) strlen(record->user_name) : 0;
+	constants->database_name = record->database_name;
+	constants->database_name_len =
+		record->database_name ? (int) strlen(record->database_name) : 0;
+	constants->backend_type = record->backend_type;
+	constants->backend_type_len =
+		record->backend_type ? (int) strlen(record->backend_type) : 0;
+}
+
+/*
+ * Gets the parts of the prefix that are the same for all the messages of the
+ * backend that the record comes from, rendering them if that's a different
+ * backend than last time.
+ *
+ * That's told by the addresses of the strings, which stay put for as long as
+ * the backend lives.  Not so with the strings of a decoded record, which
+ * live in memory that's reset between records, or freed by an error, and
+ * may be reused for other strings at the same addresses.  Those are rendered
+ * afresh for each record, never into the cache.
+ */
+static InterceptPrefixConstants *
+get_prefix_constants(InterceptLogRecord *record)
+{
+	static InterceptPrefixConstants decoded_constants;
+
+	if (record->decoded)
+	{
+		render_prefix_constants(&decoded_constants, record);
+		return &decoded_constants;
+	}
+
+	if (intercept_prefix_constants.pid != record->pid ||
+		intercept_prefix_constants.user_name != record->user_name ||
+		intercept_prefix_constants.database_name != record->database_name ||
+		intercept_prefix_constants.backend_type != record->backend_type)
+		render_prefix_constants(&intercept_prefix_constants, record);
+
+	return &intercept_prefix_constants;
+}
+
+/*
+ * Adds the prefix as per line_prefix.
+ *
+ * All the lines of a message carry the same timestamp.  Numbers are rendered
+ * without going through printf, and the parts that don't change within a
+ * backend are rendered just once.
+ */
+static void
+add_prefix(StringInfo buf, InterceptLogRecord *record)
+{
+	InterceptPrefix *prefix = intercept_prefix;
+	const char *text;
+	InterceptPrefixConstants *constants;
+	char		num[MAXINT8LEN + 1];
+	int			i;
+
+	if (prefix == NULL)
+		return;
+
+	text = INTERCEPT_PREFIX_TEXT(prefix);
+	constants = get_prefix_constants(record);
+
+	for (i = 0; i < prefix->nops; i++)
+	{
+		InterceptPrefixOp *op = &prefix->ops[i];
+		int			start = buf->len;
+
+		switch (op->escape)
+		{
+			case '\0':
+				appendBinaryStringInfo(buf, text + op->offset, op->len);
+				break;
+			case 'a':
+				if (record->session_process)
+					appendStringInfoString(buf, record->application_name ?
+										   record->application_name :
+										   _("[unknown]"));
+				break;
+			case 'b':
+				if (constants->backend_type)
+					appendBinaryStringInfo(buf, constants->backend_type,
+										   constants->backend_type_len);
+				break;
+			case 'u':
+				if (record->session_process)
+				{
+					if (constants->user_name)
+						appendBinaryStringInfo(buf, constants->user_name,
+											   constants->user_name_len);
+					else
+						appendStringInfoString(buf, _("[unknown]"));
+				}
+				break;
+			case 'd':
+				if (record->session_process)
+				{
+					if (constants->database_name)
+						appendBinaryStringInfo(buf, constants->database_name,
+											   constants->database_name_len);
+					else
+						appendStringInfoString(buf, _("[unknown]"));
+				}
+				break;
+			case 'p':
+				appendBinaryStringInfo(buf, constants->pid_str,
+									   constants->pid_len);
+				break;
+			case 'P':
+				if (record->leader_pid != 0)
+					append_int(buf, record->leader_pid);
+				break;
+			case 'l':
+				appendBinaryStringInfo(buf, num,
+									   pg_lltoa(record->session_line_num, num));
+				break;
+			case 'm':
+				appendStringInfoString(buf, record->formatted_log_time);
+				break;
+			case 't':
+				/* the timestamp minus the pasted in milliseconds */
+				appendBinaryStringInfo(buf, record->formatted_log_time, 19);
+				appendStringInfoString(buf, record->formatted_log_time + 23);
+				break;
+			case 'n':
+				appendBinaryStringInfo(buf, num,
+									   pg_lltoa((int64) record->log_time.tv_sec,
+												num));
+				appendStringInfoCharMacro(buf, '.');
+				appendStringInfoCharMacro(buf, '0' + (record->log_time.tv_usec / 100000) % 10);
+				appendStringInfoCharMacro(buf, '0' + (record->log_time.tv_usec / 10000) % 10);
+				appendStringInfoCharMacro(buf, '0' + (record->log_time.tv_usec / 1000) % 10);
+				break;
+			case 's':
+				appendStringInfoString(buf,
+									   get_formatted_session_start_time(record->session_start));
+				break;
+			case 'i':
+				if (record->command_tag)
+					appendBinaryStringInfo(buf, record->command_tag,
+										   record->command_tag_len);
+				break;
+			case 'r':
+				if (record->remote_host)
+				{
+					appendStringInfoString(buf, record->remote_host);
+					if (record->remote_port &&
+						record->remote_port[0] != '\0')
+					{
+						appendStringInfoCharMacro(buf, '(');
+						appendStringInfoString(buf, record->remote_port);
+						appendStringInfoCharMacro(buf, ')');
+					}
+				}
+				break;
+			case 'h':
+				if (record->remote_host)
+					appendStringInfoString(buf, record->remote_host);
+				break;
+			case 'q':
+				/* in postmaster and friends, stop if %q is seen */
+				if (!record->session_process)
+					return;
+				break;
+			case 'c':
+				append_hex(buf, (uint64) record->session_start);
+				appendStringInfoCharMacro(buf, '.');
+				append_hex(buf, (uint64) record->pid);
+				break;
+			case 'v':
+				if (record->vxid_backend_id >= 0)
+				{
+					append_int(buf, record->vxid_backend_id);
+					appendStringInfoCharMacro(buf, '/');
+					append_uint(buf, record->vxid_local_xid);
+				}
+				break;
+			case 'x':
+				append_uint(buf, record->xid);
+				break;
+			case 'e':
+				appendStringInfoString(buf,
+									   unpack_sql_state(record->sqlerrcode));
+				break;
+			case 'Q':
+				appendBinaryStringInfo(buf, num,
+									   pg_lltoa(record->query_id, num));
+				break;
+			default:
+				break;
+		}
+
+		pad_from(buf, start, op->padding);
+	}
+}
+
+/*
+ * Writes the provided line to stderr.
+ */
+static void
+write_console(const char *line, int len)
+{
+	int			rc;
+
+	/*
+	 * We ignore any error from write() here.  We have no useful way to report
+	 * it ... certainly whining on stderr isn't likely to be productive.
+	 */
+	rc = write(fileno(stderr), line, len);
+	(void) rc;
+}
+
+/*
+ * Gets the intercept log file cache slot for elevel.
+ *
+ * Levels that share a severity name, and hence a file, share a slot.
+ */
+static inline int
+intercept_log_slot(int elevel)
+{
+	if (elevel == LOG_SERVER_ONLY)
+		return LOG;
+	if (elevel == WARNING_CLIENT_ONLY)
+		return WARNING;
+
+	return elevel;
+}
+
+/*
+ * Formats the segment as it appears in file names into stamp, which must be
+ * of INTERCEPT_STAMP_LEN size: YYYY-MM-DD_HHMMSS for the first segment started
+ * within a second, then YYYY-MM-DD_HHMMSS-1 and so on.
+ */
+static void
+format_intercept_segment_stamp(char *stamp, uint64 segment)
+{
+	pg_time_t	start = INTERCEPT_SEGMENT_TIME(segment);
+	uint32		seq = INTERCEPT_SEGMENT_SEQ(segment);
+
+	pg_strftime(stamp, INTERCEPT_TIME_LEN, "%Y-%m-%d_%H%M%S",
+				pg_localtime(&start, log_timezone));
+	if (seq > 0)
+		snprintf(stamp + INTERCEPT_TIME_LEN - 1,
+				 INTERCEPT_STAMP_LEN - INTERCEPT_TIME_LEN + 1, "-%u", seq);
+}
+
+/*
+ * Computes the path of the intercept log file of elevel into path, which must
+ * be of MAXPGPATH * 2 size.
+ */
+static void
+get_intercept_log_file_path(char *path, int elevel, uint64 segment_start)
+{
+	char		stamp[INTERCEPT_STAMP_LEN];
+
+	if (segment_start == 0)
+	{
+		snprintf(path, MAXPGPATH * 2, "%s/%s.%s", log_directory,
+				 _(intercept_log_severity(elevel)),
+				 intercept_log_file_extension());
+		return;
+	}
+
+	format_intercept_segment_stamp(stamp, segment_start);
+	snprintf(path, MAXPGPATH * 2, "%s/%s_%s.%s", log_directory,
+			 _(intercept_log_severity(elevel)), stamp,
+			 intercept_log_file_extension());
+}
+
+/*
+ * Gets the current segment of the intercept log file of the slot, which goes
+ * into the file name, see get_intercept_log_file_path.  0 stands for the
+ * plain "log_level.log" file, used until a rotation happens.
+ *
+ * With rotation_age or rotation_size set, the first write starts a segment,
+ * and a write into a segment older than rotation_age starts the next one.
+ * This is a read of an atomic on the write path, rotation takes no lock.
+ */
+static uint64
+get_intercept_log_segment(int slot)
+{
+	uint64		segment_start;
+
+	/* Rotation needs shared memory. */
+	if (intercept_shared == NULL)
+		return 0;
+
+	segment_start = pg_atomic_read_u64(&intercept_shared->segment_start[slot]);
+
+	if (segment_start == 0 ? (rotation_age > 0 || rotation_size > 0) :
+		(rotation_age > 0 &&
+		 (pg_time_t) time(NULL) - INTERCEPT_SEGMENT_TIME(segment_start) >=
+		 (pg_time_t) rotation_age * SECS_PER_MINUTE))
+		segment_start = rotate_intercept_log_segment(slot, segment_start);
+
+	return segment_start;
+}
+
+/*
+ * Starts a new segment of the intercept log file of the slot, unless some
+ * other process has already started one after segment_start, in which case
+ * that one goes.  Returns the current segment.
+ *
+ * A segment started within the same second as the previous one, or before it
+ * if the clock went back, takes the next sequence number of the previous one
+ * so that each segment gets a file of its own.  Past the last sequence
+ * number, the previous segment goes on until the next second.
+ */
+static uint64
+rotate_intercept_log_segment(int slot, uint64 segment_start)
+{
+	pg_time_t	now = (pg_time_t) time(NULL);
+	uint64		next;
+
+	if (now > INTERCEPT_SEGMENT_TIME(segment_start))
+		next = (uint64) now << INTERCEPT_SEGMENT_SEQ_BITS;
+	else if (INTERCEPT_SEGMENT_SEQ(segment_start) < INTERCEPT_SEGMENT_SEQ_MAX)
+		next = segment_start + 1;
+	else
+		return segment_start;
+
+	if (!pg_atomic_compare_exchange_u64(&intercept_shared->segment_start[slot],
+										&segment_start, next))
+		return segment_start;
+
+	pg_atomic_write_u64(&intercept_shared->segment_bytes[slot], 0);
+
+	return next;
+}
+
+/*
+ * Gets the extension of the intercept log files for log_format.
+ */
+static const char *
+intercept_log_file_extension(void)
+{
+	switch (log_format)
+	{
+		case INTERCEPT_FORMAT_JSON:
+			return "json";
+		case INTERCEPT_FORMAT_CSV:
+			return "csv";
+		case INTERCEPT_FORMAT_BINARY:
+			return "bin";
+		case INTERCEPT_FORMAT_TEXT:
+		case INTERCEPT_FORMAT_COMPACT:
+		default:
+			return "log";
+	}
+}
+
+/*
+ * Gets a descriptor for the intercept log file of elevel, opening it if it is
+ * not already open.
+ *
+ * *cached is set to false if the descriptor could not be kept in the cache, in
+ * which case the caller must close it after use.  Returns -1 with errno set if
+ * the file could not be opened.
+ */
+static int
+open_intercept_log_file(int elevel, bool *cached)
+{
+	InterceptLogFile *file = &intercept_log_files[intercept_log_slot(elevel)];
+	char		fullpath[MAXPGPATH * 2];
+	int			fd;
+	int			save_errno;
+
+	*cached = true;
+
+	if (file->fd >= 0)
+	{
+		if (file->inherited && IsUnderPostmaster)
+		{
+			/*
+			 * A descriptor inherited from the postmaster is ours now.  It's
+			 * already open, so keep it even if it can't be accounted for.
+			 */
+			file->inherited = false;
+			file->external_fd = AcquireExternalFD();
+			register_intercept_log_files_cleanup();
+		}
+
+		return file->fd;
+	}
+
+	get_intercept_log_file_path(fullpath, elevel, file->segment_start);
+
+	/*
+	 * Long-lived descriptors must be accounted for, so that fd.c doesn't use
+	 * up the descriptors we hold.  If we're not allowed any more, fall back to
+	 * opening the file just for this write.
+	 */
+	if (!AcquireExternalFD())
+	{
+		*cached = false;
+		return open(fullpath, O_WRONLY | O_CREAT | O_APPEND,
+					pg_file_create_mode);
+	}
+
+	fd = open(fullpath, O_WRONLY | O_CREAT | O_APPEND, pg_file_create_mode);
+
+	if (fd < 0)
+	{
+		save_errno = errno;
+		ReleaseExternalFD();
+		errno = save_errno;
+		return -1;
+	}
+
+	register_intercept_log_files_cleanup();
+
+	file->fd = fd;
+	file->external_fd = true;
+
+	return fd;
+}
+
+/*
+ * Closes the cached intercept log file, if open.
+ */
+static void
+close_intercept_log_file(InterceptLogFile *file)
+{
+	if (file->fd < 0)
+		return;
+
+	close(file->fd);
+
+	if (file->external_fd)
+		ReleaseExternalFD();
+
+	file->fd = -1;
+	file->external_fd = false;
+	file->inherited = false;
+
+	/* Whatever file comes next hasn't seen our statements and strings. */
+	file->statement_id = 0;
+	file->generation++;
+}
+
+/*
+ * Closes all the intercept log files that this backend has open.
+ */
+static void
+close_intercept_log_files(void)
+{
+	int			i;
+
+	for (i = 0; i < INTERCEPT_NUM_SLOTS; i++)
+		close_intercept_log_file(&intercept_log_files[i]);
+}
+
+/*
+ * on_proc_exit callback to close the intercept log files.
+ */
+static void
+close_intercept_log_files_at_exit(int code, Datum arg)
+{
+	close_intercept_log_files();
+}
+
+/*
+ * Writes data to the intercept log file of elevel.
+ *
+ * Returns false with errno set on failure, *open_failed tells whether it was
+ * the open or the write that failed.
+ */
+static bool
+write_intercept_log_file(int elevel, const char *data, int len,
+						 bool *open_failed)
+{
+	int			slot = intercept_log_slot(elevel);
+	InterceptLogFile *file = &intercept_log_files[slot];
+	uint64		segment_start;
+	int			fd;
+	bool		cached;
+	int			save_errno;
+
+	*open_failed = false;
+
+	/*
+	 * Out of disk space, or backing off after a failure, discard the messages
+	 * rather than fail to write every one of them.
+	 */
+	if (intercept_disk_full() || intercept_log_file_backing_off(file))
+	{
+		discard_intercept_log_data(file, data, len);
+		return true;
+	}
+
+	/* Move on to the current segment if the file has been rotated. */
+	segment_start = get_intercept_log_segment(slot);
+	if (file->segment_start != segment_start)
+	{
+		close_intercept_log_file(file);
+		file->segment_start = segment_start;
+	}
+
+	fd = open_intercept_log_file(elevel, &cached);
+
+	if (fd < 0)
+	{
+		*open_failed = true;
+		return false;
+	}
+
+	errno = 0;
+	if (write(fd, data, len) != len)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		save_errno = errno ? errno : ENOSPC;
+
+		if (save_errno == ENOSPC
+#ifdef EDQUOT
+			|| save_errno == EDQUOT
+#endif
+			)
+			set_intercept_disk_full(true);
+
+		/*
+		 * Don't keep using a descriptor that failed us, the next message will
+		 * reopen the file.
+		 */
+		if (cached)
+			close_intercept_log_file(file);
+		else
+			close(fd);
+
+		errno = save_errno;
+		return false;
+	}
+
+	if (!cached)
+		close(fd);
+
+	file->retry_delay = 0;
+	file->failure_reported = false;
+
+	if (rotation_size > 0 && intercept_shared != NULL &&
+		pg_atomic_add_fetch_u64(&intercept_shared->segment_bytes[slot], len) >=
+		(uint64) rotation_size * 1024)
+		(void) rotate_intercept_log_segment(slot, segment_start);
+
+	return true;
+}
+
+/*
+ * Is the file not to be written to yet, as per on_write_failure = retry?
+ */
+static bool
+intercept_log_file_backing_off(InterceptLogFile *file)
+{
+	return on_write_failure == INTERCEPT_FAILURE_RETRY &&
+		file->retry_delay > 0 && GetCurrentTimestamp() < file->retry_at;
+}
+
+/*
+ * Gets rid of len bytes of data that aren't going to make it into the
+ * intercept log file, as per on_write_failure.
+ *
+ * The data may have carried string definitions and statements that the
+ * messages to come refer to, those have to be written again.  The writer
+ * process discards the lines of any backend, it tells them all.
+ */
+static void
+discard_intercept_log_data(InterceptLogFile *file, const char *data, int len)
+{
+	file->statement_id = 0;
+	file->generation++;
+	if (am_intercept_writer)
+		pg_atomic_fetch_add_u32(&intercept_shared->segment_losses[file - intercept_log_files], 1);
+
+	/* Binary records would only garble the standard error. */
+	if (on_write_failure == INTERCEPT_FAILURE_STDERR &&
+		log_format != INTERCEPT_FORMAT_BINARY)
+	{
+		if (write(fileno(stderr), data, len) == len)
+			return;
+	}
+
+	if (intercept_shared != NULL)
+		pg_atomic_fetch_add_u64(&intercept_shared->dropped_bytes, len);
+}
+
+/*
+ * Deals with write_intercept_log_file failing to write out len bytes of data
+ * into the intercept log file of elevel.  errno must still be the one set by
+ * write_intercept_log_file.
+ *
+ * Returns true if the caller, which says whether it can with can_keep, is to
+ * hold on to the data for a later retry.  Otherwise, the data is disposed of
+ * as per on_write_failure.
+ *
+ * Nothing is reported but by the writer process, once per run of failures:
+ * backends get here from within intercept_log, where an ERROR would abort the
+ * query over a logging problem if not recurse into the error machinery in the
+ * middle of another error.  The failure is counted for
+ * pg_intercept_server_logs_stats() instead.
+ */
+static bool
+intercept_log_file_failed(int elevel, const char *data, int len,
+						  bool open_failed, bool can_keep)
+{
+	InterceptLogFile *file = &intercept_log_files[intercept_log_slot(elevel)];
+	int			save_errno = errno;
+	TimestampTz now = GetCurrentTimestamp();
+	bool		keep = false;
+
+	if (intercept_shared != NULL)
+	{
+		pg_atomic_fetch_add_u64(&intercept_shared->write_failures, 1);
+		pg_atomic_write_u32(&intercept_shared->last_errno, (uint32) save_errno);
+		pg_atomic_write_u64(&intercept_shared->last_failure_time,
+							(uint64) now);
+	}
+
+	if (on_write_failure == INTERCEPT_FAILURE_RETRY)
+	{
+		file->retry_delay = file->retry_delay == 0 ?
+			INTERCEPT_RETRY_MIN_DELAY :
+			Min(file->retry_delay * 2, INTERCEPT_RETRY_MAX_DELAY);
+		file->retry_at = TimestampTzPlusMilliseconds(now, file->retry_delay);
+		keep = can_keep;
+	}
+
+	if (!keep)
+		discard_intercept_log_data(file, data, len);
+
+	/*
+	 * Only the first failure of a run of them is reported, those that follow
+	 * until the file is written to again are only counted: with drop, every
+	 * message would otherwise add a line to the server log, likely on the
+	 * same broken disk.  Running out of space is reported all the same, it
+	 * switches to dropping the messages for a while.
+	 */
+	if (am_intercept_writer &&
+		(!file->failure_reported || (!open_failed && intercept_disk_full())))
+	{
+		errno = save_errno;
+		report_intercept_log_file_error(elevel, open_failed);
+		file->failure_reported = true;
+	}
+
+	return keep;
+}
+
+/*
+ * Reports failure of write_intercept_log_file as LOG, for the writer process.
+ * errno must still be the one set by write_intercept_log_file.
+ */
+static void
+report_intercept_log_file_error(int elevel, bool open_failed)
+{
+	char		fullpath[MAXPGPATH * 2];
+	int			save_errno = errno;
+
+	get_intercept_log_file_path(fullpath, elevel,
+								intercept_log_files[intercept_log_slot(elevel)].segment_start);
+	errno = save_errno;
+
+	/* Running out of space is reported once, on switching to drop mode. */
+	if (!open_failed && intercept_disk_full())
+		ereport(LOG,
+				(errcode_for_file_access(),
+				 errmsg("could not write intercept log file \"%s\": %m",
+						fullpath),
+				 errdetail("Intercepted messages are dropped for %d seconds, or until the retention worker frees up space.",
+						   INTERCEPT_DISK_FULL_RETRY)));
+	else if (open_failed)
+		ereport(LOG,
+				(errcode_for_file_access(),
+					errmsg("could not open intercept log file \"%s\": %m",
+						   fullpath)));
+	else
+		ereport(LOG,
+				(errcode_for_file_access(),
+					errmsg("could not write intercept log file \"%s\": %m",
+						   fullpath)));
+}
+
+/*
+ * Adds the line to the write-combining buffer of the intercept log file of
+ * elevel, flushing the buffer when it fills up or has been holding lines for
+ * longer than flush_interval.  The buffer is (re)allocated to be size bytes.
+ *
+ * Returns false if the line couldn't be buffered, in which case the caller
+ * must write it out itself.  Anything buffered before is flushed in that case
+ * so that the lines stay in order.
+ */
+static bool
+buffer_intercept_log_line(int elevel, const char *line, int len, int size)
+{
+	InterceptLogFile *file = &intercept_log_files[intercept_log_slot(elevel)];
+	TimestampTz now;
+
+	if (len > size)
+	{
+		flush_intercept_log_buffer(elevel);
+		return false;
+	}
+
+	/* (Re)allocate the buffer if buffer_size changed since we last used it. */
+	if (file->buffer == NULL || file->buffer_size != size)
+	{
+		flush_intercept_log_buffer(elevel);
+
+		if (file->buffer != NULL)
+		{
+			/* whatever is kept for a retry goes with the old buffer */
+			if (file->buffer_len > 0)
+				discard_intercept_log_data(file, file->buffer,
+										   file->buffer_len);
+			file->buffer_len = 0;
+			pfree(file->buffer);
+		}
+
+		file->buffer_size = 0;
+		file->buffer = MemoryContextAllocExtended(TopMemoryContext, size,
+												  MCXT_ALLOC_NO_OOM);
+		if (file->buffer == NULL)
+			return false;
+		file->buffer_size = size;
+
+		if (intercept_log_buffers_cleanup_pid != MyProcPid)
+		{
+			before_shmem_exit(flush_intercept_log_buffers_at_exit, (Datum) 0);
+			intercept_log_buffers_cleanup_pid = MyProcPid;
+		}
+	}
+
+	if (file->buffer_len + len > file->buffer_size)
+	{
+		flush_intercept_log_buffer(elevel);
+
+		/* Still full of lines kept for a retry. */
+		if (file->buffer_len + len > file->buffer_size)
+			return false;
+	}
+
+	now = GetCurrentTimestamp();
+
+	if (file->buffer_len == 0)
+		file->buffer_start = now;
+
+	memcpy(file->buffer + file->buffer_len, line, len);
+	file->buffer_len += len;
+
+	if (flush_interval > 0 &&
+		TimestampDifferenceExceeds(file->buffer_start, now, flush_interval))
+		flush_intercept_log_buffer(elevel);
+
+	return true;
+}
+
+/*
+ * Writes out the buffered lines of the intercept log file of elevel.
+ *
+ * On failure, the buffered lines are kept for a later retry with
+ * on_write_failure = retry, and disposed of otherwise.  They are left alone
+ * while backing off.
+ */
+static void
+flush_intercept_log_buffer(int elevel)
+{
+	InterceptLogFile *file = &intercept_log_files[intercept_log_slot(elevel)];
+	int			len = file->buffer_len;
+	bool		open_failed;
+
+	if (len == 0 || intercept_log_file_backing_off(file))
+		return;
+
+	file->buffer_len = 0;
+
+	if (!write_intercept_log_file(elevel, file->buffer, len, &open_failed) &&
+		intercept_log_file_failed(elevel, file->buffer, len, open_failed, true))
+		file->buffer_len = len;
+}
+
+/*
+ * Writes out the buffered lines of all the intercept log files.
+ */
+static void
+flush_intercept_log_buffers(void)
+{
+	int			i;
+
+	for (i = 0; i < INTERCEPT_NUM_SLOTS; i++)
+	{
+		if (intercept_log_files[i].buffer_len > 0)
+			flush_intercept_log_buffer(i);
+	}
+}
+
+/*
+ * Writes out the buffered lines of all the intercept log files from outside of
+ * intercept_log, which mustn't intercept anything into the very buffers we're
+ * flushing meanwhile.
+ */
+static void
+flush_intercept_log_buffers_outside_hook(void)
+{
+	if (in_intercept_log_hook)
+		return;
+
+	in_intercept_log_hook = true;
+	flush_intercept_log_buffers();
+	in_intercept_log_hook = false;
+}
+
+/*
+ * Transaction callback to write out the buffered lines at transaction end and
+ * to keep log_min_messages lowered.
+ */
+static void
+intercept_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		case XACT_EVENT_PREPARE:
+			break;
+		default:
+			return;
+	}
+
+	flush_intercept_log_buffers_outside_hook();
+
+	/*
+	 * log_min_messages may have been set since we last looked at it, in which
+	 * case the messages we want may not be reaching intercept_log to notice.
+	 */
+	if (override_log_min_messages &&
+		log_min_messages != lowered_log_min_messages)
+		apply_log_min_messages_override(intercept_level_mask,
+										override_log_min_messages);
+}
+
+/*
+ * before_shmem_exit callback to write out the buffered lines.
+ */
+static void
+flush_intercept_log_buffers_at_exit(int code, Datum arg)
+{
+	int			i;
+
+	/* Last chance, don't wait out the backoff nor keep anything for later. */
+	for (i = 0; i < INTERCEPT_NUM_SLOTS; i++)
+		intercept_log_files[i].retry_delay = 0;
+
+	flush_intercept_log_buffers_outside_hook();
+
+	for (i = 0; i < INTERCEPT_NUM_SLOTS; i++)
+	{
+		InterceptLogFile *file = &intercept_log_files[i];
+
+		if (file->buffer_len > 0)
+		{
+			discard_intercept_log_data(file, file->buffer, file->buffer_len);
+			file->buffer_len = 0;
+		}
+	}
+}
+
+/*
+ * Writes the provided line to intercept log file.
+ */
+static void
+write_file(const char *line, int len, int elevel)
+{
+	bool		open_failed;
+
+	/*
+	 * Hand the line over to the writer process if we can.  PANIC is written
+	 * out right here as the shared memory won't survive the crash restart.
+	 */
+	if (elevel < PANIC && use_intercept_ring())
+	{
+		flush_intercept_log_buffer(elevel);
+
+		if (insert_into_intercept_ring(line, len, elevel, false))
+			return;
+	}
+
+	/*
+	 * FATAL and PANIC are written out right away along with everything that's
+	 * buffered so far, as the backend or the whole server is about to go
+	 * away.
+	 */
+	if (elevel >= FATAL)
+		flush_intercept_log_buffers();
+	else if (buffer_size > 0)
+	{
+		if (buffer_intercept_log_line(elevel, line, len, buffer_size * 1024))
+			return;
+	}
+	else
+		flush_intercept_log_buffer(elevel);
+
+	if (!write_intercept_log_file(elevel, line, len, &open_failed))
+		(void) intercept_log_file_failed(elevel, line, len, open_failed,
+										 false);
+}
+
+/*
+ * Computes the shared memory size needed for the ring buffer.
+ */
+static Size
+intercept_shmem_size(void)
+{
+	return add_size(offsetof(InterceptSharedState, ring),
+					mul_size(ring_buffer_size, 1024));
+}
+
+/*
+ * shmem_request hook: request shared memory for the ring buffer.
+ */
+static void
+intercept_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(intercept_shmem_size());
+}
+
+/*
+ * shmem_startup hook: allocate or attach to the shared memory.
+ */
+static void
+intercept_shmem_startup(void)
+{
+	bool		found;
+	int			i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	intercept_shared = ShmemInitStruct("pg_intercept_server_logs",
+									   intercept_shmem_size(),
+									   &found);
+
+	if (!found)
+	{
+		SpinLockInit(&intercept_shared->mutex);
+		intercept_shared->writer_running = false;
+		intercept_shared->writer_latch = NULL;
+		intercept_shared->log_directory[0] = '\0';
+		intercept_shared->log_format = INTERCEPT_FORMAT_TEXT;
+		pg_atomic_init_u32(&intercept_shared->destination_generation, 0);
+		pg_atomic_init_u64(&intercept_shared->ring_overflows, 0);
+		for (i = 0; i < INTERCEPT_NUM_SLOTS; i++)
+		{
+			pg_atomic_init_u64(&intercept_shared->segment_start[i], 0);
+			pg_atomic_init_u64(&intercept_shared->segment_bytes[i], 0);
+			pg_atomic_init_u32(&intercept_shared->segment_losses[i], 0);
+		}
+		pg_atomic_init_u64(&intercept_shared->disk_full_until, 0);
+		pg_atomic_init_u64(&intercept_shared->dropped_bytes, 0);
+		pg_atomic_init_u64(&intercept_shared->removed_files, 0);
+		pg_atomic_init_u64(&intercept_shared->removed_bytes, 0);
+		pg_atomic_init_u64(&intercept_shared->write_failures, 0);
+		pg_atomic_init_u32(&intercept_shared->last_errno, 0);
+		pg_atomic_init_u64(&intercept_shared->last_failure_time, 0);
+		pg_atomic_init_u64(&intercept_shared->suppressed_messages, 0);
+		for (i = 0; i < INTERCEPT_RATE_BUCKETS; i++)
+		{
+			InterceptRateBucket *bucket = &intercept_shared->rate_buckets[i];
+
+			pg_atomic_init_u64(&bucket->key, 0);
+			SpinLockInit(&bucket->mutex);
+			bucket->tokens = 0;
+			bucket->last_refill = 0;
+			bucket->suppressed = 0;
+			bucket->elevel = 0;
+			bucket->sqlerrcode = 0;
+			bucket->lineno = 0;
+			bucket->filename[0] = '\0';
+		}
+		intercept_shared->ring_size = (Size) ring_buffer_size * 1024;
+		pg_atomic_init_u32(&intercept_shared->inserters, 0);
+		pg_atomic_init_u64(&intercept_shared->insert_pos, 0);
+		pg_atomic_init_u64(&intercept_shared->read_pos, 0);
+		memset(intercept_shared->ring, 0, intercept_shared->ring_size);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	/*
+	 * Open the intercept log files in the postmaster, so that the backends
+	 * don't have to.  That's done only now for the file names to follow the
+	 * segments in shared memory.  From now on, the GUC assign hooks reopen
+	 * them as the settings change.
+	 */
+	if (IsPostmasterEnvironment && !IsUnderPostmaster)
+	{
+		open_intercept_log_files_for_children = true;
+		open_intercept_log_files_in_postmaster(true);
+	}
+}
+
+/*
+ * Tells whether our lines can be handed over to the writer process.
+ *
+ * That's the case only when the writer is running and writes into the same
+ * files that we would write into.  The postmaster never touches the
+ * ring, it must not depend on the shared memory being sane.
+ */
+static bool
+use_intercept_ring(void)
+{
+	uint32		generation;
+
+	if (intercept_shared == NULL || am_intercept_writer || !IsUnderPostmaster)
+		return false;
+
+	generation = pg_atomic_read_u32(&intercept_shared->destination_generation);
+
+	if (!ring_destination_checked || generation != ring_destination_generation)
+	{
+		SpinLockAcquire(&intercept_shared->mutex);
+		ring_destination_matches =
+			strcmp(intercept_shared->log_directory, log_directory) == 0 &&
+			intercept_shared->log_format == log_format;
+		ring_destination_generation =
+			pg_atomic_read_u32(&intercept_shared->destination_generation);
+		SpinLockRelease(&intercept_shared->mutex);
+
+		ring_destination_checked = true;
+	}
+
+	return ring_destination_matches && intercept_shared->writer_running;
+}
+
+/*
+ * Copies the line into the shared ring buffer and wakes up the writer.
+ *
+ * Returns false if the ring doesn't have room for the line, in which case the
+ * caller must write it out itself.
+ */
+static bool
+insert_into_intercept_ring(const char *line, int len, int elevel,
+						   bool deferred)
+{
+	InterceptSharedState *shared = intercept_shared;
+	Size		ring_size = shared->ring_size;
+	Size		total = INTERCEPT_RING_RECORD_SIZE(len);
+	uint64		insert_pos;
+	Size		offset;
+	Size		first;
+	InterceptRingRecord *record;
+	Latch	   *latch;
+
+	/* Don't let a single line hog the ring. */
+	if (total > ring_size / 4)
+	{
+		pg_atomic_fetch_add_u64(&shared->ring_overflows, 1);
+		return false;
+	}
+
+	/*
+	 * The writer may have stopped since use_intercept_ring looked, and then
+	 * nobody would write the record out.  The atomic increment is a full
+	 * barrier, so either we see writer_running cleared or the writer sees us
+	 * in inserters.
+	 */
+	pg_atomic_fetch_add_u32(&shared->inserters, 1);
+	if (!shared->writer_running)
+	{
+		pg_atomic_fetch_sub_u32(&shared->inserters, 1);
+		return false;
+	}
+
+	/* Reserve space for the record. */
+	insert_pos = pg_atomic_read_u64(&shared->insert_pos);
+	for (;;)
+	{
+		if (insert_pos + total - pg_atomic_read_u64(&shared->read_pos) > ring_size)
+		{
+			pg_atomic_fetch_sub_u32(&shared->inserters, 1);
+			pg_atomic_fetch_add_u64(&shared->ring_overflows, 1);
+			return false;
+		}
+
+		if (pg_atomic_compare_exchange_u64(&shared->insert_pos, &insert_pos,
+										   insert_pos + total))
+			break;
+	}
+
+	offset = insert_pos % ring_size;
+	record = (InterceptRingRecord *) (shared->ring + offset);
+	record->len = len;
+	record->elevel = elevel;
+	record->deferred = deferred;
+
+	/* Copy the line in, wrapping around the end of the ring if needed. */
+	offset += sizeof(InterceptRingRecord);
+	if (offset >= ring_size)
+		offset -= ring_size;
+	first = Min((Size) len, ring_size - offset);
+	memcpy(shared->ring + offset, line, first);
+	memcpy(shared->ring, line + first, len - first);
+
+	pg_write_barrier();
+	record->committed = 1;
+
+	pg_atomic_fetch_sub_u32(&shared->inserters, 1);
+
+	latch = shared->writer_latch;
+	if (latch != NULL)
+		SetLatch(latch);
+
+	return true;
+}
+
+/*
+ * Makes the writer's log_directory and log_format known to the backends.
+ */
+static void
+publish_intercept_writer_destination(void)
+{
+	SpinLockAcquire(&intercept_shared->mutex);
+	strlcpy(intercept_shared->log_directory, log_directory, MAXPGPATH);
+	intercept_shared->log_format = log_format;
+	pg_atomic_fetch_add_u32(&intercept_shared->destination_generation, 1);
+	SpinLockRelease(&intercept_shared->mutex);
+}
+
+/*
+ * Writes out all the committed lines in the ring buffer.
+ *
+ * Lines are collected into per-file buffers, so that the intercept log files
+ * get written in large sequential chunks.  A line that wraps around the end
+ * of the ring is reassembled in a scratch buffer first, as it must be written
+ * with a single write() like any other line.
+ */
+static void
+drain_intercept_ring(void)
+{
+	static char *scratch = NULL;
+	InterceptSharedState *shared = intercept_shared;
+	Size		ring_size = shared->ring_size;
+	uint64		read_pos;
+	uint64		insert_pos;
+
+	if (scratch == NULL)
+		scratch = MemoryContextAlloc(TopMemoryContext, ring_size / 4);
+
+	/* Don't intercept the messages that we ourselves emit meanwhile. */
+	in_intercept_log_hook = true;
+
+	read_pos = pg_atomic_read_u64(&shared->read_pos);
+	insert_pos = pg_atomic_read_u64(&shared->insert_pos);
+
+	while (read_pos < insert_pos)
+	{
+		Size		offset = read_pos % ring_size;
+		InterceptRingRecord *record;
+		Size		total;
+		Size		first;
+		char	   *line;
+		int			len;
+		int			line_len;
+		int			elevel;
+
+		record = (InterceptRingRecord *) (shared->ring + offset);
+
+		/* Stop at the first record whose backend is still copying it in. */
+		if (!record->committed)
+			break;
+
+		pg_read_barrier();
+
+		len = record->len;
+		elevel = record->elevel;
+		total = INTERCEPT_RING_RECORD_SIZE(len);
+
+		offset += sizeof(InterceptRingRecord);
+		if (offset >= ring_size)
+			offset -= ring_size;
+		first = Min((Size) len, ring_size - offset);
+
+		if (first == (Size) len)
+			line = shared->ring + offset;
+		else
+		{
+			memcpy(scratch, shared->ring + offset, first);
+			memcpy(scratch + first, shared->ring, len - first);
+			line = scratch;
+		}
+
+		line_len = len;
+		if (record->deferred)
+		{
+			StringInfo	rendered = render_deferred_intercept_log_record(line,
+																		len);
+
+			line = rendered->data;
+			line_len = rendered->len;
+		}
+
+		if (!buffer_intercept_log_line(elevel, line, line_len,
+									   INTERCEPT_WRITER_BUFFER_SIZE))
+		{
+			bool		open_failed;
+
+			if (!write_intercept_log_file(elevel, line, line_len,
+										  &open_failed))
+				(void) intercept_log_file_failed(elevel, line, line_len,
+												 open_failed, false);
+		}
+
+		/* Zero out the record and hand its space back to the backends. */
+		offset = read_pos % ring_size;
+		first = Min(total, ring_size - offset);
+		memset(shared->ring + offset, 0, first);
+		memset(shared->ring, 0, total - first);
+
+		read_pos += total;
+
+		pg_write_barrier();
+		pg_atomic_write_u64(&shared->read_pos, read_pos);
+
+		/* Pick up whatever got inserted meanwhile. */
+		if (read_pos == insert_pos)
+			insert_pos = pg_atomic_read_u64(&shared->insert_pos);
+	}
+
+	flush_intercept_log_buffers();
+
+	in_intercept_log_hook = false;
+}
+
+/*
+ * on_shmem_exit callback of the writer process.
+ */
+static void
+intercept_writer_exit(int code, Datum arg)
+{
+	SpinLockAcquire(&intercept_shared->mutex);
+	intercept_shared->writer_running = false;
+	intercept_shared->writer_latch = NULL;
+	SpinLockRelease(&intercept_shared->mutex);
+}
+
+/*
+ * Main entry point of the writer process, which writes out the lines that the
+ * backends put into the shared ring buffer.
+ */
+void
+pg_intercept_server_logs_writer_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	am_intercept_writer = true;
+
+	before_shmem_exit(intercept_writer_exit, (Datum) 0);
+
+	publish_intercept_writer_destination();
+
+	SpinLockAcquire(&intercept_shared->mutex);
+	intercept_shared->writer_latch = MyLatch;
+	intercept_shared->writer_running = true;
+	SpinLockRelease(&intercept_shared->mutex);
+
+	while (!ShutdownRequestPending)
+	{
+		ResetLatch(MyLatch);
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+			publish_intercept_writer_destination();
+		}
+
+		flush_intercept_suppressed_summaries(false);
+		drain_intercept_ring();
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 INTERCEPT_WRITER_NAPTIME,
+						 PG_WAIT_EXTENSION);
+	}
+
+	/* The storms still going on won't get their summaries otherwise. */
+	flush_intercept_suppressed_summaries(true);
+
+	/*
+	 * Stop backends from using the ring before writing out what's left in it,
+	 * once those already copying their line in are done with it.
+	 */
+	intercept_writer_exit(0, (Datum) 0);
+	pg_memory_barrier();
+	while (pg_atomic_read_u32(&intercept_shared->inserters) != 0)
+		pg_usleep(1000L);
+	drain_intercept_ring();
+
+	proc_exit(0);
+}
+
+/*
+ * Are we out of disk space for the intercept log files?  Messages are dropped
+ * meanwhile, rather than each failing to be written.  Either the retention
+ * worker freeing up space or INTERCEPT_DISK_FULL_RETRY passing ends it.
+ */
+static bool
+intercept_disk_full(void)
+{
+	pg_time_t	until;
+
+	if (intercept_shared != NULL)
+		until = (pg_time_t) pg_atomic_read_u64(&intercept_shared->disk_full_until);
+	else
+		until = local_disk_full_until;
+
+	return until != 0 && (pg_time_t) time(NULL) < until;
+}
+
+static void
+set_intercept_disk_full(bool full)
+{
+	pg_time_t	until = full ? (pg_time_t) time(NULL) + INTERCEPT_DISK_FULL_RETRY : 0;
+
+	if (intercept_shared != NULL)
+		pg_atomic_write_u64(&intercept_shared->disk_full_until, (uint64) until);
+	else
+		local_disk_full_until = until;
+}
+
+/*
+ * Tells whether name is that of a rotated intercept log file, and if so, the
+ * start time and sequence number of the segment, into segment, and whether
+ * it's sealed, that is, not the current segment of its slot.  current_stamps
+ * has the current segment of each slot as it appears in file names, empty for
+ * the plain log_level.ext file.
+ */
+static bool
+parse_intercept_log_segment_name(const char *name,
+								 char current_stamps[][INTERCEPT_STAMP_LEN],
+								 InterceptLogSegment *segment,
+								 bool *sealed)
+{
+	int			slot;
+
+	for (slot = 0; slot < INTERCEPT_NUM_SLOTS; slot++)
+	{
+		const char *severity = intercept_log_severity(slot);
+		size_t		len;
+		const char *stamp;
+		const char *ext;
+		size_t		stamp_len;
+		uint32		seq = 0;
+
+		if (slot != intercept_log_slot(slot) || strcmp(severity, "???") == 0)
+			continue;
+
+		severity = _(severity);
+		len = strlen(severity);
+		if (strncmp(name, severity, len) != 0 || name[len] != '_')
+			continue;
+
+		/* log_level_YYYY-MM-DD_HHMMSS[-N].ext */
+		stamp = name + len + 1;
+		if (strlen(stamp) <= INTERCEPT_TIME_LEN - 1)
+			continue;
+
+		ext = stamp + INTERCEPT_TIME_LEN - 1;
+		if (*ext == '-')
+		{
+			const char *digits = ++ext;
+
+			while (*ext >= '0' && *ext <= '9' &&
+				   ext - digits < INTERCEPT_STAMP_LEN - INTERCEPT_TIME_LEN - 1)
+				seq = seq * 10 + (*ext++ - '0');
+			if (ext == digits || *digits == '0' ||
+				seq > INTERCEPT_SEGMENT_SEQ_MAX)
+				continue;
+		}
+		if (*ext != '.')
+			continue;
+		stamp_len = ext++ - stamp;
+
+		if (strcmp(ext, "log") != 0 && strcmp(ext, "json") != 0 &&
+			strcmp(ext, "csv") != 0 && strcmp(ext, "bin") != 0)
+			continue;
+
+		memcpy(segment->time, stamp, INTERCEPT_TIME_LEN - 1);
+		segment->time[INTERCEPT_TIME_LEN - 1] = '\0';
+		segment->seq = seq;
+		*sealed = strlen(current_stamps[slot]) != stamp_len ||
+			strncmp(stamp, current_stamps[slot], stamp_len) != 0;
+		return true;
+	}
+
+	return false;
+}
+
+static int
+intercept_log_segment_cmp(const void *a, const void *b)
+{
+	const InterceptLogSegment *sa = (const InterceptLogSegment *) a;
+	const InterceptLogSegment *sb = (const InterceptLogSegment *) b;
+	int			cmp;
+
+	if (sa->mtime != sb->mtime)
+		return sa->mtime < sb->mtime ? -1 : 1;
+
+	/* Segments rotated within the same second, by start time then sequence. */
+	cmp = strcmp(sa->time, sb->time);
+	if (cmp != 0)
+		return cmp;
+	if (sa->seq != sb->seq)
+		return sa->seq < sb->seq ? -1 : 1;
+
+	return strcmp(sa->name, sb->name);
+}
+
+/*
+ * Removes sealed segments of the intercept log files in log_directory, oldest
+ * first, as long as they are older than retention_age or the files take up
+ * more than retention_size.  Only rotated files are ever removed, never the
+ * current segments or the plain log_level.log files, although those count
+ * towards retention_size.
+ */
+static void
+enforce_intercept_log_retention(void)
+{
+	char		current_stamps[INTERCEPT_NUM_SLOTS][INTERCEPT_STAMP_LEN];
+	InterceptLogSegment *segments;
+	int			nsegments = 0;
+	int			maxsegments = 64;
+	uint64		total = 0;
+	bool		reclaimed = false;
+	pg_time_t	now = (pg_time_t) time(NULL);
+	DIR		   *dir;
+	struct dirent *de;
+	int			slot;
+	int			i;
+
+	if (log_directory[0] == '\0' || (retention_age == 0 && retention_size == 0))
+		return;
+
+	for (slot = 0; slot < INTERCEPT_NUM_SLOTS; slot++)
+	{
+		uint64		segment_start =
+			pg_atomic_read_u64(&intercept_shared->segment_start[slot]);
+
+		current_stamps[slot][0] = '\0';
+		if (segment_start != 0)
+			format_intercept_segment_stamp(current_stamps[slot], segment_start);
+	}
+
+	segments = palloc(maxsegments * sizeof(InterceptLogSegment));
+
+	/* A missing directory is reported, and tried again next time. */
+	dir = AllocateDir(log_directory);
+	while ((de = ReadDirExtended(dir, log_directory, LOG)) != NULL)
+	{
+		char		path[MAXPGPATH * 2];
+		struct stat st;
+		bool		sealed;
+
+		if (nsegments == maxsegments)
+		{
+			maxsegments *= 2;
+			segments = repalloc(segments,
+								maxsegments * sizeof(InterceptLogSegment));
+		}
+
+		if (!parse_intercept_log_segment_name(de->d_name, current_stamps,
+											  &segments[nsegments], &sealed))
+		{
+			char		plain[MAXPGPATH];
+			bool		ours = false;
+
+			/* The plain log_level.ext files count towards the quota. */
+			for (slot = 0; slot < INTERCEPT_NUM_SLOTS && !ours; slot++)
+			{
+				if (slot != intercept_log_slot(slot) ||
+					strcmp(intercept_log_severity(slot), "???") == 0)
+					continue;
+				snprintf(plain, sizeof(plain), "%s.",
+						 _(intercept_log_severity(slot)));
+				ours = strncmp(de->d_name, plain, strlen(plain)) == 0;
+			}
+
+			if (!ours)
+				continue;
+			sealed = false;
+		}
+
+		snprintf(path, sizeof(path), "%s/%s", log_directory, de->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		total += (uint64) st.st_size;
+
+		if (!sealed)
+			continue;
+
+		strlcpy(segments[nsegments].name, de->d_name, MAXPGPATH);
+		segments[nsegments].size = (uint64) st.st_size;
+		segments[nsegments].mtime = (pg_time_t) st.st_mtime;
+		nsegments++;
+	}
+	FreeDir(dir);
+
+	qsort(segments, nsegments, sizeof(InterceptLogSegment),
+		  intercept_log_segment_cmp);
+
+	for (i = 0; i < nsegments; i++)
+	{
+		InterceptLogSegment *segment = &segments[i];
+		char		path[MAXPGPATH * 2];
+		bool		too_old;
+		bool		over_quota;
+
+		too_old = retention_age > 0 &&
+			now - segment->mtime >= (pg_time_t) retention_age * SECS_PER_MINUTE;
+		over_quota = retention_size > 0 &&
+			total > (uint64) retention_size * 1024;
+
+		/* The rest are newer still. */
+		if (!too_old && !over_quota)
+			break;
+
+		snprintf(path, sizeof(path), "%s/%s", log_directory, segment->name);
+		if (unlink(path) != 0)
+		{
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not remove intercept log file \"%s\": %m",
+							path)));
+			continue;
+		}
+
+		total -= segment->size;
+		pg_atomic_fetch_add_u64(&intercept_shared->removed_files, 1);
+		pg_atomic_fetch_add_u64(&intercept_shared->removed_bytes,
+								segment->size);
+		reclaimed = true;
+	}
+
+	pfree(segments);
+
+	/* Let the processes try writing again. */
+	if (reclaimed)
+		set_intercept_disk_full(false);
+}
+
+/*
+ * Main entry point of the retention worker, see
+ * enforce_intercept_log_retention.
+ */
+void
+pg_intercept_server_logs_retention_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	while (!ShutdownRequestPending)
+	{
+		ResetLatch(MyLatch);
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		enforce_intercept_log_retention();
+		flush_intercept_suppressed_summaries(false);
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 INTERCEPT_RETENTION_NAPTIME,
+						 PG_WAIT_EXTENSION);
+	}
+
+	/* The storms still going on won't get their summaries otherwise. */
+	flush_intercept_suppressed_summaries(true);
+
+	proc_exit(0);
+}
+
+/*
+ * Appends the decimal representation of value, without going through printf.
+ */
+static void
+append_int(StringInfo buf, int32 value)
+{
+	char		num[12];
+
+	appendBinaryStringInfo(buf, num, pg_ltoa(value, num));
+}
+
+static void
+append_uint(StringInfo buf, uint32 value)
+{
+	char		num[11];
+
+	appendBinaryStringInfo(buf, num, pg_ultoa_n(value, num));
+}
+
+/*
+ * Appends len bytes of str as a quoted CSV field, doubling the double quotes.
+ * Nothing is appended for a NULL str, like csvlog does.
+ *
+ * The string is gone through once: the runs between double quotes are found
+ * with memchr and copied in bulk.
+ */
+static void
+append_csv_literal(StringInfo buf, const char *str, int len)
+{
+	const char *end;
+	const char *quote;
+
+	if (str == NULL)
+		return;
+
+	end = str + len;
+
+	/* Make room for the whole string up front, doubled quotes aside. */
+	enlargeStringInfo(buf, len + 2);
+	appendStringInfoCharMacro(buf, '"');
+
+	while ((quote = memchr(str, '"', end - str)) != NULL)
+	{
+		appendBinaryStringInfo(buf, str, (int) (quote - str + 1));
+		appendStringInfoCharMacro(buf, '"');
+		str = quote + 1;
+	}
+
+	appendBinaryStringInfo(buf, str, (int) (end - str));
+	appendStringInfoCharMacro(buf, '"');
+}
+
+#define append_csv_string(buf, str) \
+	append_csv_literal((buf), (str), (str) ? (int) strlen(str) : 0)
+
+/*
+ * Puts the truncation marker inside the closing quote of the CSV or JSON
+ * string just appended.
+ */
+static void
+insert_truncation_marker(StringInfo buf)
+{
+	Assert(buf->len > 0 && buf->data[buf->len - 1] == '"');
+
+	buf->len--;
+	appendStringInfoString(buf, INTERCEPT_TRUNCATION_MARKER);
+	appendStringInfoCharMacro(buf, '"');
+}
+
+/*
+ * Gets the formatted session start time, which is computed once per session.
+ */
+static const char *
+get_formatted_session_start_time(pg_time_t session_start)
+{
+	static char formatted_start_time[FORMATTED_TS_LEN];
+	static pg_time_t formatted_session_start = -1;
+
+	if (session_start != formatted_session_start)
+	{
+		/*
+		 * Note: we expect that guc.c will ensure that log_timezone is set up
+		 * (at least with a minimal GMT value).
+		 */
+		pg_strftime(formatted_start_time, FORMATTED_TS_LEN,
+					"%Y-%m-%d %H:%M:%S %Z",
+					pg_localtime(&session_start, log_timezone));
+		formatted_session_start = session_start;
+	}
+
+	return formatted_start_time;
+}
+
+/*
+ * Formats the record as a line with the columns of the server's csvlog, so
+ * that the intercept log files can be loaded with COPY into the same table
+ * that csvlog files are.
+ *
+ * Note that unlike csvlog, the statement and the location are always
+ * included, and that the backtrace is not as csvlog has no column for it.
+ */
+static void
+format_csv_intercept_log_record(StringInfo buf, InterceptLogRecord *record)
+{
+	char		num[MAXINT8LEN + 1];
+
+	/* timestamp with milliseconds */
+	appendStringInfoString(buf, record->formatted_log_time);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* username */
+	append_csv_string(buf, record->user_name);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* database name */
+	append_csv_string(buf, record->database_name);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* Process id */
+	append_int(buf, record->pid);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* Remote host and port */
+	if (record->remote_host)
+	{
+		appendStringInfoCharMacro(buf, '"');
+		appendStringInfoString(buf, record->remote_host);
+		if (record->remote_port && record->remote_port[0] != '\0')
+		{
+			appendStringInfoCharMacro(buf, ':');
+			appendStringInfoString(buf, record->remote_port);
+		}
+		appendStringInfoCharMacro(buf, '"');
+	}
+	appendStringInfoCharMacro(buf, ',');
+
+	/* session id */
+	appendStringInfo(buf, "%lx.%x", (long) record->session_start,
+					 record->pid);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* Line number */
+	appendBinaryStringInfo(buf, num,
+						   pg_lltoa(record->session_line_num, num));
+	appendStringInfoCharMacro(buf, ',');
+
+	/* PS display */
+	append_csv_literal(buf, record->command_tag, record->command_tag_len);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* session start timestamp */
+	appendStringInfoString(buf,
+						   get_formatted_session_start_time(record->session_start));
+	appendStringInfoCharMacro(buf, ',');
+
+	/* Virtual transaction id */
+	if (record->vxid_backend_id >= 0)
+	{
+		append_int(buf, record->vxid_backend_id);
+		appendStringInfoCharMacro(buf, '/');
+		append_uint(buf, record->vxid_local_xid);
+	}
+	appendStringInfoCharMacro(buf, ',');
+
+	/* Transaction id */
+	append_uint(buf, record->xid);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* Error severity */
+	appendStringInfoString(buf, _(intercept_log_severity(record->elevel)));
+	appendStringInfoCharMacro(buf, ',');
+
+	/* SQL state code */
+	appendStringInfoString(buf, unpack_sql_state(record->sqlerrcode));
+	appendStringInfoCharMacro(buf, ',');
+
+	/* errmessage */
+	append_csv_string(buf, record->message);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* errdetail or errdetail_log */
+	append_csv_string(buf, record->detail);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* errhint */
+	append_csv_string(buf, record->hint);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* internal query */
+	append_csv_string(buf, record->internalquery);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* if printed internal query, print internal pos too */
+	if (record->internalpos > 0 && record->internalquery != NULL)
+		append_int(buf, record->internalpos);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* errcontext */
+	append_csv_string(buf, record->context);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* user query */
+	append_csv_literal(buf, record->statement, record->statement_len);
+	if (record->statement_truncated)
+		insert_truncation_marker(buf);
+	appendStringInfoCharMacro(buf, ',');
+	if (record->statement && record->cursorpos > 0)
+		append_int(buf, record->cursorpos);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* file error location, assume no double quotes in funcname or filename */
+	if (record->filename)
+	{
+		appendStringInfoCharMacro(buf, '"');
+		if (record->funcname)
+		{
+			appendStringInfoString(buf, record->funcname);
+			appendBinaryStringInfo(buf, ", ", 2);
+		}
+		appendStringInfoString(buf, record->filename);
+		appendStringInfoCharMacro(buf, ':');
+		append_int(buf, record->lineno);
+		appendStringInfoCharMacro(buf, '"');
+	}
+	appendStringInfoCharMacro(buf, ',');
+
+	/* application name */
+	append_csv_string(buf, record->application_name);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* backend type */
+	append_csv_string(buf, record->backend_type);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* leader PID */
+	if (record->leader_pid != 0)
+		append_int(buf, record->leader_pid);
+	appendStringInfoCharMacro(buf, ',');
+
+	/* query id */
+	appendBinaryStringInfo(buf, num, pg_lltoa(record->query_id, num));
+
+	appendStringInfoCharMacro(buf, '\n');
+}
+
+/*
+ * Allocates the format buffer with the given size, starting afresh.
+ */
+static void
+init_intercept_format_buffer(int size)
+{
+	MemoryContextReset(intercept_format_context);
+
+	intercept_format_buf.data = MemoryContextAlloc(intercept_format_context,
+												   size);
+	intercept_format_buf.maxlen = size;
+	resetStringInfo(&intercept_format_buf);
+}
+
+/*
+ * Learns from the size of the message just formatted, shrinking the format
+ * buffer if an unusually large message has left it much larger than what
+ * messages need of late.  The buffer otherwise keeps the size it grew to, as
+ * enlargeStringInfo grows it in place in its own memory context.
+ */
+static void
+size_intercept_format_buffer(int len)
+{
+	int			size;
+
+	intercept_format_size_hint += (len - intercept_format_size_hint) / 8;
+
+	if (intercept_format_buf.maxlen <=
+		8 * Max(intercept_format_size_hint, INTERCEPT_FORMAT_BUFFER_MIN_SIZE))
+		return;
+
+	size = INTERCEPT_FORMAT_BUFFER_MIN_SIZE;
+	while (size < 2 * intercept_format_size_hint)
+		size *= 2;
+
+	init_intercept_format_buffer(size);
+}
+
+/*
+ * Gathers what goes into the formatted message from edata and the backend's
+ * state.
+ */
+static void
+build_intercept_log_record(InterceptLogRecord *record, ErrorData *edata)
+{
+	static long session_line_num = 0;
+	static int	session_line_num_pid = 0;
+
+	/*
+	 * The clock is read once here, whatever the format.  formatted_log_time is
+	 * filled in from it by prepare_and_emit_intercept_log_message only if it
+	 * formats the record itself.
+	 */
+	gettimeofday(&record->log_time, NULL);
+	record->formatted_log_time[0] = '\0';
+	record->pid = MyProcPid;
+	record->decoded = false;
+
+	/* Start counting afresh in a process forked from the postmaster. */
+	if (session_line_num_pid != MyProcPid)
+	{
+		session_line_num = 0;
+		session_line_num_pid = MyProcPid;
+	}
+	record->session_line_num = ++session_line_num;
+	record->session_start = MyStartTime;
+
+	record->session_process = (MyProcPort != NULL);
+
+	if (MyProcPort)
+	{
+		record->user_name = MyProcPort->user_name;
+		record->database_name = MyProcPort->database_name;
+		record->remote_host = MyProcPort->remote_host;
+		record->remote_port = MyProcPort->remote_port;
+		record->command_tag = get_ps_display(&record->command_tag_len);
+	}
+	else
+	{
+		record->user_name = NULL;
+		record->database_name = NULL;
+		record->remote_host = NULL;
+		record->remote_port = NULL;
+		record->command_tag = NULL;
+		record->command_tag_len = 0;
+	}
+
+	record->vxid_backend_id = -1;
+	record->vxid_local_xid = 0;
+	record->leader_pid = 0;
+	if (MyProc != NULL)
+	{
+		PGPROC	   *leader = MyProc->lockGroupLeader;
+
+#if PG_VERSION_NUM >= 170000
+		if (MyProc->vxid.procNumber != INVALID_PROC_NUMBER)
+		{
+			record->vxid_backend_id = MyProc->vxid.procNumber;
+			record->vxid_local_xid = MyProc->vxid.lxid;
+		}
+#else
+		if (MyProc->backendId != InvalidBackendId)
+		{
+			record->vxid_backend_id = MyProc->backendId;
+			record->vxid_local_xid = MyProc->lxid;
+		}
+#endif
+
+		if (leader && leader->pid != MyProcPid)
+			record->leader_pid = leader->pid;
+	}
+	record->xid = GetTopTransactionIdIfAny();
+	record->query_id = (int64) pgstat_get_my_query_id();
+
+	if (application_name && application_name[0] != '\0')
+		record->application_name = application_name;
+	else
+		record->application_name = NULL;
+
+	/* Background workers say what kind they are, as in elog.c. */
+	if (MyBackendType == B_BG_WORKER && MyBgworkerEntry)
+		record->backend_type = MyBgworkerEntry->bgw_type;
+	else
+		record->backend_type = GetBackendTypeDesc(MyBackendType);
+
+	record->elevel = edata->elevel;
+	record->sqlerrcode = edata->sqlerrcode;
+	record->message = NULL;
+	record->detail = NULL;
+	record->hint = NULL;
+	record->internalquery = NULL;
+	record->internalpos = 0;
+	record->context = NULL;
+	record->cursorpos = 0;
+	record->funcname = NULL;
+	record->filename = NULL;
+	record->lineno = 0;
+	record->backtrace = NULL;
+	record->statement = NULL;
+	record->statement_len = 0;
+	record->statement_truncated = false;
+
+	/*
+	 * Leave out the fields not asked for, before anything is done with them.
+	 * The positions go with the texts they are positions in.
+	 */
+	if (intercept_field_mask & INTERCEPT_FIELD_MESSAGE)
+		record->message = edata->message ? edata->message :
+			_("missing error text");
+	if (intercept_field_mask & INTERCEPT_FIELD_DETAIL)
+		record->detail = edata->detail_log ? edata->detail_log : edata->detail;
+	if (intercept_field_mask & INTERCEPT_FIELD_HINT)
+		record->hint = edata->hint;
+	if (intercept_field_mask & INTERCEPT_FIELD_QUERY)
+	{
+		record->internalquery = edata->internalquery;
+		record->internalpos = edata->internalpos;
+	}
+	if ((intercept_field_mask & INTERCEPT_FIELD_CONTEXT) && !edata->hide_ctx)
+		record->context = edata->context;
+	if (intercept_field_mask & INTERCEPT_FIELD_LOCATION)
+	{
+		record->funcname = edata->funcname;
+		record->filename = edata->filename;
+		record->lineno = edata->lineno;
+	}
+	if (intercept_field_mask & INTERCEPT_FIELD_BACKTRACE)
+		record->backtrace = edata->backtrace;
+
+	/*
+	 * Log the query, if exists, irrespective of whether user wants it or
+	 * hide_stmt is true unlike regular server logging facility which uses
+	 * check_log_of_query().
+	 */
+	if ((intercept_field_mask & INTERCEPT_FIELD_STATEMENT) &&
+		debug_query_string != NULL)
+	{
+		size_t		len;
+
+		record->statement = debug_query_string;
+		record->cursorpos = edata->cursorpos;
+
+		/*
+		 * Look no further than the limit, a statement can be megabytes long.
+		 * The cut doesn't split a multibyte character.
+		 */
+		if (max_statement_length < 0)
+			len = strlen(debug_query_string);
+		else
+		{
+			len = strnlen(debug_query_string, (size_t) max_statement_length + 1);
+			if (len > (size_t) max_statement_length)
+			{
+				len = pg_mbcliplen(debug_query_string, (int) len,
+								   max_statement_length);
+				record->statement_truncated = true;
+			}
+		}
+		record->statement_len = (int) len;
+	}
+
+	/*
+	 * A rotated file starts afresh, without the statements and strings that
+	 * went into the previous segment.  The writer process may be the one
+	 * doing the rotating, so we notice it here rather than when opening the
+	 * file.  Likewise if the writer discarded lines meant for the file.
+	 */
+	if (strcmp(log_directory, "") != 0)
+	{
+		int			slot = intercept_log_slot(record->elevel);
+		InterceptLogFile *file = &intercept_log_files[slot];
+		uint64		segment_start = get_intercept_log_segment(slot);
+		uint32		losses = intercept_shared != NULL ?
+			pg_atomic_read_u32(&intercept_shared->segment_losses[slot]) : 0;
+
+		if (file->formatted_segment_start != segment_start ||
+			file->formatted_losses != losses)
+		{
+			file->formatted_segment_start = segment_start;
+			file->formatted_losses = losses;
+			file->statement_id = 0;
+			file->generation++;
+		}
+	}
+
+	/*
+	 * The first message of a statement that goes into a file carries the
+	 * statement, the others only its id.  csvlog has no column for the id,
+	 * the csv format always carries the statement.
+	 */
+	record->statement_id = 0;
+	record->statement_repeated = false;
+	if (deduplicate_statements && record->statement != NULL &&
+		log_format != INTERCEPT_FORMAT_CSV)
+	{
+		InterceptLogFile *file =
+			&intercept_log_files[intercept_log_slot(record->elevel)];
+
+		record->statement_id = get_intercept_statement_id();
+		if (file->statement_id == record->statement_id)
+			record->statement_repeated = true;
+		else
+			file->statement_id = record->statement_id;
+	}
+}
+
+/*
+ * Gets the id of the statement being executed.  Statements are told apart by
+ * debug_query_string and the statement start time, either of which alone can
+ * be the same for consecutive statements.  Ids start at 1 in each backend;
+ * the pid goes with them in the output.
+ */
+static uint32
+get_intercept_statement_id(void)
+{
+	static const char *statement = NULL;
+	static TimestampTz statement_start = 0;
+	static uint32 statement_id = 0;
+	TimestampTz start = GetCurrentStatementStartTimestamp();
+
+	if (debug_query_string != statement || start != statement_start)
+	{
+		statement = debug_query_string;
+		statement_start = start;
+		if (++statement_id == 0)
+			statement_id = 1;
+	}
+
+	return statement_id;
+}
+
+/*
+ * Appends the id of the record's statement, of the form "pid.id".
+ */
+static void
+append_statement_id(StringInfo buf, InterceptLogRecord *record)
+{
+	append_int(buf, record->pid);
+	appendStringInfoCharMacro(buf, '.');
+	append_uint(buf, record->statement_id);
+}
+
+/*
+ * Starts a line other than the first one of a message: with the prefix in the
+ * regular text format, with a tab in the compact one.
+ */
+static inline void
+add_line_start(StringInfo buf, InterceptLogRecord *record, bool compact)
+{
+	if (compact)
+		appendStringInfoCharMacro(buf, '\t');
+	else
+		add_prefix(buf, record);
+}
+
+/*
+ * Formats the record as text lines similar to the server log's.
+ *
+ * In the compact layout, only the first line carries the prefix and the
+ * lines of the other fields are tab-continued like the lines of multi-line
+ * fields are, which saves most of the bytes and the formatting work of a
+ * multi-line message.
+ */
+static void
+format_text_intercept_log_record(StringInfo buf, InterceptLogRecord *record,
+								 bool compact)
+{
+	add_prefix(buf, record);
+	appendStringInfo(buf, "%s:  ", _(intercept_log_severity(record->elevel)));
+
+	if (record->sqlerrcode != 0)
+		appendStringInfo(buf, "%s:  ", unpack_sql_state(record->sqlerrcode));
+
+	if (record->message)
+		append_with_tabs(buf, record->message);
+
+	if (record->cursorpos > 0)
+		appendStringInfo(buf, _(" at character %d"),
+						 record->cursorpos);
+	else if (record->internalpos > 0)
+		appendStringInfo(buf, _(" at character %d"),
+						 record->internalpos);
+
+	appendStringInfoChar(buf, '\n');
+
+	if (record->detail)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("DETAIL:  "));
+		append_with_tabs(buf, record->detail);
+		appendStringInfoChar(buf, '\n');
+	}
+
+	if (record->hint)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("HINT:  "));
+		append_with_tabs(buf, record->hint);
+		appendStringInfoChar(buf, '\n');
+	}
+
+	if (record->internalquery)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("QUERY:  "));
+		append_with_tabs(buf, record->internalquery);
+		appendStringInfoChar(buf, '\n');
+	}
+
+	if (record->context)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("CONTEXT:  "));
+		append_with_tabs(buf, record->context);
+		appendStringInfoChar(buf, '\n');
+	}
+
+	/* assume no newlines in funcname or filename... */
+	if (record->funcname && record->filename)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfo(buf, _("LOCATION:  %s, %s:%d\n"),
+						 record->funcname, record->filename,
+						 record->lineno);
+	}
+	else if (record->filename)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfo(buf, _("LOCATION:  %s:%d\n"),
+						 record->filename, record->lineno);
+	}
+
+	if (record->backtrace)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("BACKTRACE:  "));
+		append_with_tabs(buf, record->backtrace);
+		appendStringInfoChar(buf, '\n');
+	}
+
+	if (record->statement && record->statement_id != 0)
+	{
+		/*
+		 * "STATEMENT [pid.id]:  text" the first time, "STATEMENT [pid.id]"
+		 * afterwards.
+		 */
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("STATEMENT"));
+		appendBinaryStringInfo(buf, " [", 2);
+		append_statement_id(buf, record);
+		appendStringInfoChar(buf, ']');
+		if (!record->statement_repeated)
+		{
+			appendBinaryStringInfo(buf, ":  ", 3);
+			append_with_tabs_len(buf, record->statement,
+								 record->statement_len);
+			if (record->statement_truncated)
+				appendStringInfoString(buf, INTERCEPT_TRUNCATION_MARKER);
+		}
+		appendStringInfoChar(buf, '\n');
+	}
+	else if (record->statement)
+	{
+		add_line_start(buf, record, compact);
+		appendStringInfoString(buf, _("STATEMENT:  "));
+		append_with_tabs_len(buf, record->statement, record->statement_len);
+		if (record->statement_truncated)
+			appendStringInfoString(buf, INTERCEPT_TRUNCATION_MARKER);
+		appendStringInfoChar(buf, '\n');
+	}
+}
+
+/*
+ * Escapes of the bytes that can't appear as is in a JSON string: the letter of
+ * the two-character escape, or 'u' for a \u00XX escape.  Zero means the byte
+ * needs no escaping.
+ */
+static const char json_escapes[256] = {
+	[0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u',
+	[0x05] = 'u', [0x06] = 'u', [0x07] = 'u', ['\b'] = 'b',
+	['\t'] = 't', ['\n'] = 'n', [0x0b] = 'u', ['\f'] = 'f',
+	['\r'] = 'r', [0x0e] = 'u', [0x0f] = 'u', [0x10] = 'u',
+	[0x11] = 'u', [0x12] = 'u', [0x13] = 'u', [0x14] = 'u',
+	[0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u',
+	[0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u', [0x1c] = 'u',
+	[0x1d] = 'u', [0x1e] = 'u', [0x1f] = 'u',
+	['"'] = '"', ['\\'] = '\\'
+};
+
+#define SWAR_ONES	UINT64CONST(0x0101010101010101)
+#define SWAR_HIGHS	UINT64CONST(0x8080808080808080)
+
+/*
+ * Tells whether any of the eight bytes in chunk needs escaping in a JSON
+ * string, that is, is a control character, a double quote or a backslash.
+ *
+ * (x - ones * n) & ~x & highs is non-zero iff some byte of x is less than n,
+ * for n up to 128; bytes equal to c are found as the zero bytes of x ^ c.
+ */
+static inline bool
+json_chunk_needs_escape(uint64 chunk)
+{
+	uint64		quote = chunk ^ (SWAR_ONES * '"');
+	uint64		backslash = chunk ^ (SWAR_ONES * '\\');
+
+	return (((chunk - SWAR_ONES * 0x20) & ~chunk) |
+			((quote - SWAR_ONES) & ~quote) |
+			((backslash - SWAR_ONES) & ~backslash)) & SWAR_HIGHS;
+}
+
+/*
+ * Appends str as a quoted JSON string.
+ *
+ * Runs of bytes that need no escaping, which is most of any message, are
+ * found eight bytes at a time and copied in bulk.
+ */
+static void
+append_json_string_len(StringInfo buf, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *end = str + len;
+	const char *run = str;
+	const char *p = str;
+
+	/* Make room for the whole string up front, escapes aside. */
+	enlargeStringInfo(buf, (int) (end - str) + 2);
+	appendStringInfoCharMacro(buf, '"');
+
+	for (;;)
+	{
+		uint64		chunk;
+		char		escape;
+
+		while (end - p >= (ptrdiff_t) sizeof(chunk))
+		{
+			memcpy(&chunk, p, sizeof(chunk));
+			if (json_chunk_needs_escape(chunk))
+				break;
+			p += sizeof(chunk);
+		}
+
+		while (p < end && json_escapes[(unsigned char) *p] == 0)
+			p++;
+
+		if (p > run)
+			appendBinaryStringInfo(buf, run, (int) (p - run));
+
+		if (p == end)
+			break;
+
+		escape = json_escapes[(unsigned char) *p];
+		appendStringInfoCharMacro(buf, '\\');
+		if (escape == 'u')
+		{
+			appendBinaryStringInfo(buf, "u00", 3);
+			appendStringInfoCharMacro(buf, hex[(unsigned char) *p >> 4]);
+			appendStringInfoCharMacro(buf, hex[(unsigned char) *p & 0x0f]);
+		}
+		else
+			appendStringInfoCharMacro(buf, escape);
+
+		run = ++p;
+	}
+
+	appendStringInfoCharMacro(buf, '"');
+}
+
+#define append_json_string(buf, str) \
+	append_json_string_len((buf), (str), strlen(str))
+
+/*
+ * Appends a string member to the JSON object being built, unless value is
+ * NULL.  The key goes in as is, it's assumed not to need escaping.
+ */
+static void
+append_json_key_value_len(StringInfo buf, const char *key, const char *value,
+						  size_t len)
+{
+	if (value == NULL)
+		return;
+
+	appendStringInfoCharMacro(buf, ',');
+	appendStringInfoCharMacro(buf, '"');
+	appendStringInfoString(buf, key);
+	appendBinaryStringInfo(buf, "\":", 2);
+	append_json_string_len(buf, value, len);
+}
+
+#define append_json_key_value(buf, key, value) \
+	append_json_key_value_len((buf), (key), (value), \
+							  (value) ? strlen(value) : 0)
+
+/*
+ * Appends an integer member to the JSON object being built.
+ */
+static void
+append_json_key_int(StringInfo buf, const char *key, int value)
+{
+	char		num[12];
+	int			len;
+
+	len = pg_ltoa(value, num);
+
+	appendStringInfoCharMacro(buf, ',');
+	appendStringInfoCharMacro(buf, '"');
+	appendStringInfoString(buf, key);
+	appendBinaryStringInfo(buf, "\":", 2);
+	appendBinaryStringInfo(buf, num, len);
+}
+
+/*
+ * Formats the record as a JSON object on a line of its own.  The keys are the
+ * same as those of the server's jsonlog.
+ */
+static void
+format_json_intercept_log_record(StringInfo buf, InterceptLogRecord *record)
+{
+	appendBinaryStringInfo(buf, "{\"timestamp\":", 13);
+	append_json_string(buf, record->formatted_log_time);
+	append_json_key_value(buf, "user", record->user_name);
+	append_json_key_value(buf, "dbname", record->database_name);
+	append_json_key_int(buf, "pid", record->pid);
+	append_json_key_value(buf, "error_severity",
+						  intercept_log_severity(record->elevel));
+	append_json_key_value(buf, "state_code",
+						  unpack_sql_state(record->sqlerrcode));
+	append_json_key_value(buf, "message", record->message);
+	append_json_key_value(buf, "detail", record->detail);
+	append_json_key_value(buf, "hint", record->hint);
+	append_json_key_value(buf, "internal_query", record->internalquery);
+	if (record->internalpos > 0)
+		append_json_key_int(buf, "internal_position", record->internalpos);
+	append_json_key_value(buf, "context", record->context);
+	if (record->statement && record->statement_id != 0)
+	{
+		appendStringInfoString(buf, ",\"statement_id\":\"");
+		append_statement_id(buf, record);
+		appendStringInfoCharMacro(buf, '"');
+	}
+	if (!record->statement_repeated)
+	{
+		append_json_key_value_len(buf, "statement", record->statement,
+								  record->statement_len);
+		if (record->statement_truncated)
+			insert_truncation_marker(buf);
+	}
+	if (record->cursorpos > 0)
+		append_json_key_int(buf, "cursor_position", record->cursorpos);
+	if (record->filename)
+	{
+		append_json_key_value(buf, "func_name", record->funcname);
+		append_json_key_value(buf, "file_name", record->filename);
+		append_json_key_int(buf, "file_line_num", record->lineno);
+	}
+	append_json_key_value(buf, "backtrace", record->backtrace);
+	append_json_key_value(buf, "application_name", record->application_name);
+	append_json_key_value(buf, "backend_type", record->backend_type);
+	appendBinaryStringInfo(buf, "}\n", 2);
+}
+
+/*
+ * Starts a unit of the binary format: a four-byte little-endian length of
+ * what follows, patched in by end_binary_unit, and the unit type.  Returns
+ * where the unit starts.
+ */
+static int
+begin_binary_unit(StringInfo buf, char type)
+{
+	int			start = buf->len;
+
+	appendBinaryStringInfo(buf, "\0\0\0\0", 4);
+	appendStringInfoCharMacro(buf, type);
+
+	return start;
+}
+
+static void
+end_binary_unit(StringInfo buf, int start)
+{
+	uint32		len = buf->len - start - 4;
+	unsigned char *p = (unsigned char *) buf->data + start;
+
+	p[0] = len & 0xFF;
+	p[1] = (len >> 8) & 0xFF;
+	p[2] = (len >> 16) & 0xFF;
+	p[3] = (len >> 24) & 0xFF;
+}
+
+/*
+ * Appends value as a varint: seven bits per byte, least significant first,
+ * the high bit set on all the bytes but the last.
+ */
+static void
+append_varint(StringInfo buf, uint64 value)
+{
+	char		bytes[10];
+	int			n = 0;
+
+	do
+	{
+		uint8		byte = value & 0x7F;
+
+		value >>= 7;
+		if (value != 0)
+			byte |= 0x80;
+		bytes[n++] = (char) byte;
+	} while (value != 0);
+
+	appendBinaryStringInfo(buf, bytes, n);
+}
+
+/*
+ * Appends a string of the binary format: its length plus one as a varint,
+ * then its bytes.  NULL goes in as a zero length.
+ */
+static void
+append_binary_string(StringInfo buf, const char *str, int len)
+{
+	if (str == NULL)
+	{
+		appendStringInfoCharMacro(buf, '\0');
+		return;
+	}
+
+	append_varint(buf, (uint64) len + 1);
+	appendBinaryStringInfo(buf, str, len);
+}
+
+#define append_binary_cstring(buf, str) \
+	append_binary_string((buf), (str), (str) ? (int) strlen(str) : 0)
+
+/*
+ * Allocator of the hash tables used from within intercept_log, which must
+ * not raise an error: running out of memory makes HASH_ENTER_NULL return
+ * NULL instead.
+ */
+static void *
+intercept_hash_alloc(Size size)
+{
+	return MemoryContextAllocExtended(TopMemoryContext, size,
+									  MCXT_ALLOC_NO_OOM);
+}
+
+/*
+ * Creates a hash table keyed by the bytes of the key, to be filled in from
+ * within intercept_log.  Must be called while it's fine to raise an error.
+ */
+static HTAB *
+create_intercept_hash(const char *name, Size keysize, Size entrysize)
+{
+	HASHCTL		ctl;
+
+	ctl.keysize = keysize;
+	ctl.entrysize = entrysize;
+	ctl.alloc = intercept_hash_alloc;
+
+	return hash_create(name, 256, &ctl, HASH_ELEM | HASH_BLOBS | HASH_ALLOC);
+}
+
+/*
+ * Removes all the entries of a table made by create_intercept_hash, which
+ * can't be destroyed.  Their memory is kept for the entries to come.
+ */
+static void
+clear_intercept_hash(HTAB *table)
+{
+	HASH_SEQ_STATUS status;
+	void	   *entry;
+
+	hash_seq_init(&status, table);
+	while ((entry = hash_seq_search(&status)) != NULL)
+		(void) hash_search(table, entry, HASH_REMOVE, NULL);
+}
+
+/*
+ * Gets into *id the id of a string that stays put for the life of the
+ * backend, such as __FILE__ and __func__ of the ereport() call sites,
+ * appending its definition to the buffer the first time it goes into the
+ * file of the given slot.  The id is 0 for NULL.
+ *
+ * Strings are looked up by address, so the text is copied into a file once,
+ * not with every record.  Ids are per backend; a definition unit carries the
+ * pid along with the id, so backends sharing a file don't get in each
+ * other's way.
+ *
+ * Returns false if the string couldn't be interned, for lack of memory or
+ * because the backend has interned INTERCEPT_INTERN_MAX_STRINGS already, in
+ * which case the record is to carry its strings inline.
+ */
+static bool
+intern_intercept_string(StringInfo buf, const char *str, int slot,
+						uint32 *id)
+{
+	InterceptInternEntry *entry;
+	InterceptLogFile *file = &intercept_log_files[slot];
+	bool		found;
+	int			start;
+
+	*id = 0;
+	if (str == NULL)
+		return true;
+
+	/* Ids of the postmaster aren't ours to use. */
+	if (intercept_intern_pid != MyProcPid)
+	{
+		clear_intercept_hash(intercept_intern_table);
+		intercept_intern_pid = MyProcPid;
+		intercept_intern_next_id = 1;
+	}
+
+	entry = (InterceptInternEntry *) hash_search(intercept_intern_table,
+												 &str, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		if (hash_get_num_entries(intercept_intern_table) >=
+			INTERCEPT_INTERN_MAX_STRINGS)
+			return false;
+
+		entry = (InterceptInternEntry *) hash_search(intercept_intern_table,
+													 &str, HASH_ENTER_NULL,
+													 &found);
+		if (entry == NULL)
+			return false;
+
+		entry->id = intercept_intern_next_id++;
+		memset(entry->generation, 0, sizeof(entry->generation));
+	}
+
+	if (entry->generation[slot] != file->generation)
 	{
-		GUC_check_errdetail("specified intercept log directory does not exist");
-		return false;
+		start = begin_binary_unit(buf, INTERCEPT_BINARY_DEFINITION);
+		append_varint(buf, (uint64) MyProcPid);
+		append_varint(buf, entry->id);
+		appendStringInfoString(buf, str);
+		end_binary_unit(buf, start);
+
+		entry->generation[slot] = file->generation;
 	}
 
+	*id = entry->id;
 	return true;
 }
 
 /*
- * is_log_level_output -- is elevel logically >= log_min_level?
- *
- * We use this for tests that should consider LOG to sort out-of-order,
- * between ERROR and FATAL.  Generally this is the right thing for testing
- * whether a message should go to the postmaster log, whereas a simple >=
- * test is correct for testing whether the message should go to the client.
+ * Formats the record in the binary format: definition units for the strings
+ * not yet interned into the file, then a record unit.  Numbers are varints,
+ * signed ones zigzag-encoded, and only the text that varies from one message
+ * to the next is copied.  pg_intercept_server_logs_decode() renders the
+ * records in the other formats.
  *
- * This function is similar to is_log_level_output function in elog.c.
+ * Without intern, the result is a single inline record unit that carries the
+ * strings that'd be interned as well, for the writer process to render.  The
+ * same goes for a record whose strings couldn't all be interned.
  */
-static inline bool
-is_log_level_output(int elevel, int log_min_level)
+static void
+format_binary_intercept_log_record(StringInfo buf, InterceptLogRecord *record,
+								   bool intern)
 {
-	if (elevel == LOG || elevel == LOG_SERVER_ONLY)
+	int			slot = intercept_log_slot(record->elevel);
+	uint32		user_name_id = 0;
+	uint32		database_name_id = 0;
+	uint32		backend_type_id = 0;
+	uint32		funcname_id = 0;
+	uint32		filename_id = 0;
+	uint32		flags = 0;
+	int			start;
+
+	if (intern)
+		intern = intern_intercept_string(buf, record->user_name, slot,
+										 &user_name_id) &&
+			intern_intercept_string(buf, record->database_name, slot,
+									&database_name_id) &&
+			intern_intercept_string(buf, record->backend_type, slot,
+									&backend_type_id) &&
+			intern_intercept_string(buf, record->funcname, slot,
+									&funcname_id) &&
+			intern_intercept_string(buf, record->filename, slot,
+									&filename_id);
+
+	if (record->session_process)
+		flags |= INTERCEPT_BINARY_SESSION_PROCESS;
+	if (record->statement_truncated)
+		flags |= INTERCEPT_BINARY_STATEMENT_TRUNCATED;
+	if (record->statement_repeated)
+		flags |= INTERCEPT_BINARY_STATEMENT_REPEATED;
+
+	start = begin_binary_unit(buf, intern ? INTERCEPT_BINARY_RECORD :
+							  INTERCEPT_BINARY_INLINE_RECORD);
+	append_varint(buf, (uint64) record->pid);
+	append_varint(buf, (uint64) record->elevel);
+	append_varint(buf, (uint32) record->sqlerrcode);
+	append_varint(buf, ZIGZAG(record->log_time.tv_sec));
+	append_varint(buf, (uint64) record->log_time.tv_usec);
+	append_varint(buf, ZIGZAG(record->session_start));
+	append_varint(buf, (uint64) record->session_line_num);
+	append_varint(buf, flags);
+	if (intern)
 	{
-		if (log_min_level == LOG || log_min_level <= ERROR)
-			return true;
+		append_varint(buf, user_name_id);
+		append_varint(buf, database_name_id);
+		append_varint(buf, backend_type_id);
 	}
-	else if (elevel == WARNING_CLIENT_ONLY)
+	else
 	{
-		/* never sent to log, regardless of log_min_level */
-		return false;
+		append_binary_cstring(buf, record->user_name);
+		append_binary_cstring(buf, record->database_name);
+		append_binary_cstring(buf, record->backend_type);
 	}
-	else if (log_min_level == LOG)
+	append_binary_cstring(buf, record->application_name);
+	append_binary_cstring(buf, record->remote_host);
+	append_binary_cstring(buf, record->remote_port);
+	append_binary_string(buf, record->command_tag, record->command_tag_len);
+	append_varint(buf, (uint64) (record->vxid_backend_id + 1));
+	append_varint(buf, record->vxid_local_xid);
+	append_varint(buf, record->xid);
+	append_varint(buf, (uint64) record->leader_pid);
+	append_varint(buf, ZIGZAG(record->query_id));
+	append_binary_cstring(buf, record->message);
+	append_binary_cstring(buf, record->detail);
+	append_binary_cstring(buf, record->hint);
+	append_binary_cstring(buf, record->internalquery);
+	append_varint(buf, (uint64) Max(record->internalpos, 0));
+	append_binary_cstring(buf, record->context);
+	append_varint(buf, (uint64) Max(record->cursorpos, 0));
+	if (intern)
 	{
-		/* elevel != LOG */
-		if (elevel >= FATAL)
-			return true;
+		append_varint(buf, funcname_id);
+		append_varint(buf, filename_id);
 	}
-	/* Neither is LOG */
-	else if (elevel >= log_min_level)
-		return true;
-
-	return false;
+	else
+	{
+		append_binary_cstring(buf, record->funcname);
+		append_binary_cstring(buf, record->filename);
+	}
+	append_varint(buf, (uint64) Max(record->lineno, 0));
+	append_binary_cstring(buf, record->backtrace);
+	append_binary_string(buf, record->statement_repeated ? NULL :
+						 record->statement, record->statement_len);
+	append_varint(buf, record->statement_id);
+	end_binary_unit(buf, start);
 }
 
 /*
- * Checks that the provided log level.
+ * Reads a varint of the binary format off the unit.
  */
-static bool
-check_intercept_log_level(int *newval, void **extra, GucSource source)
+static uint64
+read_binary_varint(StringInfo unit)
 {
-	/* Accept 'none'. */
-	if (*newval == LOG_LEVEL_NONE)
-		return true;
+	uint64		value = 0;
+	int			shift;
 
-	if (!is_log_level_output(*newval, log_min_messages))
+	for (shift = 0; shift < 64; shift += 7)
 	{
-		GUC_check_errcode(ERRCODE_INVALID_PARAMETER_VALUE);
-		GUC_check_errmsg("cannot set \"pg_intercept_server_logs.log_level\" to more than the level at which server emits logs");
-		GUC_check_errhint("You can increase server's log level by setting \"log_min_messages\" parameter to at least \"pg_intercept_server_logs.log_level\".");
+		uint8		byte;
 
-		return false;
+		if (unit->cursor >= unit->len)
+			break;
+
+		byte = (uint8) unit->data[unit->cursor++];
+		value |= ((uint64) (byte & 0x7F)) << shift;
+		if ((byte & 0x80) == 0)
+			return value;
 	}
 
-	return true;
+	ereport(ERROR,
+			(errcode(ERRCODE_DATA_CORRUPTED),
+			 errmsg("invalid record in intercept log file")));
+	return 0;					/* keep compiler quiet */
 }
 
 /*
- * Implements emit_log_hook for this module.
+ * Reads a string of the binary format off the unit, as a palloc'd
+ * NUL-terminated copy.  Returns NULL for NULL.
  */
-static void
-intercept_log(ErrorData *edata)
+static char *
+read_binary_string(StringInfo unit, int *len)
 {
-	static bool in_intercept_log_hook = false;
+	uint64		n = read_binary_varint(unit);
+	char	   *str;
 
-	/* Any other plugins which use emit_log_hook. */
-	if (original_emit_log_hook)
-		original_emit_log_hook(edata);
+	if (len)
+		*len = 0;
 
-	/* Let's not recursively call the intercept_log hook. */
-	if (in_intercept_log_hook)
-		return;
+	if (n == 0)
+		return NULL;
 
-	/* Nothing to do if no log_level is provided. */
-	if (log_level == LOG_LEVEL_NONE ||
-		edata->elevel != log_level)
-		return;
+	n--;
+	if (n > (uint64) (unit->len - unit->cursor))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid record in intercept log file")));
 
-	in_intercept_log_hook = true;
+	str = palloc(n + 1);
+	memcpy(str, unit->data + unit->cursor, n);
+	str[n] = '\0';
+	unit->cursor += (int) n;
 
-	prepare_and_emit_intercept_log_message(edata);
+	if (len)
+		*len = (int) n;
 
-	in_intercept_log_hook = false;
+	return str;
 }
 
 /*
- * Gets string representing elevel.
- *
- * This function is similar to error_severity function in elog.c except that
- * it gives separate DEBUGX as prefix as opposed to error_severity giving prefix
- * DEBUG for all DEBUGX levels.
+ * Looks up a string interned by the given backend, as defined by the last
+ * definition unit read.  A string whose definition was lost, say, when its
+ * message didn't make it to the file, comes out as NULL.  The backend writes
+ * the definition again with its next message, see discard_intercept_log_data,
+ * so that only the messages in between are affected.
  */
 static const char *
-intercept_log_severity(int elevel)
+lookup_decoded_string(HTAB *strings, int pid, uint32 id)
 {
-	const char *prefix;
+	InterceptDecodedKey key;
+	InterceptDecodedString *entry;
 
-	switch (elevel)
-	{
-		case DEBUG1:
-			prefix = gettext_noop("DEBUG1");
-			break;
-		case DEBUG2:
-			prefix = gettext_noop("DEBUG2");
-			break;
-		case DEBUG3:
-			prefix = gettext_noop("DEBUG3");
-			break;
-		case DEBUG4:
-			prefix = gettext_noop("DEBUG4");
-			break;
-		case DEBUG5:
-			prefix = gettext_noop("DEBUG5");
-			break;
-		case LOG:
-		case LOG_SERVER_ONLY:
-			prefix = gettext_noop("LOG");
-			break;
-		case INFO:
-			prefix = gettext_noop("INFO");
-			break;
-		case NOTICE:
-			prefix = gettext_noop("NOTICE");
-			break;
-		case WARNING:
-		case WARNING_CLIENT_ONLY:
-			prefix = gettext_noop("WARNING");
-			break;
-		case ERROR:
-			prefix = gettext_noop("ERROR");
-			break;
-		case FATAL:
-			prefix = gettext_noop("FATAL");
-			break;
-		case PANIC:
-			prefix = gettext_noop("PANIC");
-			break;
-		default:
-			prefix = "???";
-			break;
-	}
+	if (id == 0)
+		return NULL;
 
-	return prefix;
+	key.pid = pid;
+	key.id = id;
+	entry = (InterceptDecodedString *) hash_search(strings, &key, HASH_FIND,
+												   NULL);
+
+	return entry ? entry->str : NULL;
+}
+
+/*
+ * Reads a string that's interned in a record unit, or inline in an inline
+ * record unit, for which strings is NULL.
+ */
+static const char *
+read_binary_interned_string(StringInfo unit, HTAB *strings, int pid)
+{
+	if (strings == NULL)
+		return read_binary_string(unit, NULL);
+
+	return lookup_decoded_string(strings, pid,
+								 (uint32) read_binary_varint(unit));
 }
 
 /*
- * Computes the log timestamp.
+ * Decodes a record unit into the record, the other way round from
+ * format_binary_intercept_log_record.  strings is NULL for an inline record
+ * unit.
  */
 static void
-get_formatted_intercept_log_time(char *formatted_log_time)
+decode_binary_intercept_log_record(StringInfo unit, HTAB *strings,
+								   InterceptLogRecord *record)
 {
-	pg_time_t	stamp_time;
-	char		msbuf[13];
-	struct timeval saved_timeval;
+	uint32		flags;
 
-	gettimeofday(&saved_timeval, NULL);
+	memset(record, 0, sizeof(InterceptLogRecord));
+	record->decoded = true;
 
-	stamp_time = (pg_time_t) saved_timeval.tv_sec;
+	record->pid = (int) read_binary_varint(unit);
+	record->elevel = (int) read_binary_varint(unit);
+	record->sqlerrcode = (int) read_binary_varint(unit);
+	record->log_time.tv_sec = (time_t) UNZIGZAG(read_binary_varint(unit));
+	record->log_time.tv_usec = (suseconds_t) read_binary_varint(unit);
+	record->session_start = (pg_time_t) UNZIGZAG(read_binary_varint(unit));
+	record->session_line_num = (long) read_binary_varint(unit);
+	flags = (uint32) read_binary_varint(unit);
+	record->session_process = (flags & INTERCEPT_BINARY_SESSION_PROCESS) != 0;
+	record->statement_truncated =
+		(flags & INTERCEPT_BINARY_STATEMENT_TRUNCATED) != 0;
+	record->statement_repeated =
+		(flags & INTERCEPT_BINARY_STATEMENT_REPEATED) != 0;
+	record->user_name = read_binary_interned_string(unit, strings,
+													record->pid);
+	record->database_name = read_binary_interned_string(unit, strings,
+														record->pid);
+	record->backend_type = read_binary_interned_string(unit, strings,
+													   record->pid);
+	record->application_name = read_binary_string(unit, NULL);
+	record->remote_host = read_binary_string(unit, NULL);
+	record->remote_port = read_binary_string(unit, NULL);
+	record->command_tag = read_binary_string(unit, &record->command_tag_len);
+	record->vxid_backend_id = (int) read_binary_varint(unit) - 1;
+	record->vxid_local_xid = (uint32) read_binary_varint(unit);
+	record->xid = (TransactionId) read_binary_varint(unit);
+	record->leader_pid = (int) read_binary_varint(unit);
+	record->query_id = UNZIGZAG(read_binary_varint(unit));
+	record->message = read_binary_string(unit, NULL);
+	record->detail = read_binary_string(unit, NULL);
+	record->hint = read_binary_string(unit, NULL);
+	record->internalquery = read_binary_string(unit, NULL);
+	record->internalpos = (int) read_binary_varint(unit);
+	record->context = read_binary_string(unit, NULL);
+	record->cursorpos = (int) read_binary_varint(unit);
+	record->funcname = read_binary_interned_string(unit, strings,
+												   record->pid);
+	record->filename = read_binary_interned_string(unit, strings,
+												   record->pid);
+	record->lineno = (int) read_binary_varint(unit);
+	record->backtrace = read_binary_string(unit, NULL);
+	record->statement = read_binary_string(unit, &record->statement_len);
+	record->statement_id = (uint32) read_binary_varint(unit);
 
-	/*
-	 * Note: we expect that guc.c will ensure that log_timezone is set up (at
-	 * least with a minimal GMT value).
-	 */
-	pg_strftime(formatted_log_time, FORMATTED_TS_LEN,
-	/* leave room for milliseconds... */
-				"%Y-%m-%d %H:%M:%S     %Z",
-				pg_localtime(&stamp_time, log_timezone));
+	/* The formatters tell a repeated statement by its id alone. */
+	if (record->statement_repeated && record->statement == NULL)
+		record->statement = "";
 
-	/* 'paste' milliseconds into place... */
-	sprintf(msbuf, ".%03d", (int) (saved_timeval.tv_usec / 1000));
-	memcpy(formatted_log_time + 19, msbuf, 4);
+	format_intercept_log_time(record->formatted_log_time, &record->log_time);
 }
 
 /*
- *	Appends the string to the StringInfo buffer, inserting a tab after any
- *	newline.
+ * Formats a decoded record in one of the formats other than binary.
  */
 static void
-append_with_tabs(StringInfo buf, const char *str)
+format_decoded_intercept_log_record(StringInfo buf, InterceptLogRecord *record,
+									int format)
 {
-	char		ch;
-
-	while ((ch = *str++) != '\0')
+	switch (format)
 	{
-		appendStringInfoCharMacro(buf, ch);
-		if (ch == '\n')
-			appendStringInfoCharMacro(buf, '\t');
+		case INTERCEPT_FORMAT_JSON:
+			format_json_intercept_log_record(buf, record);
+			break;
+		case INTERCEPT_FORMAT_CSV:
+			format_csv_intercept_log_record(buf, record);
+			break;
+		case INTERCEPT_FORMAT_COMPACT:
+			format_text_intercept_log_record(buf, record, true);
+			break;
+		case INTERCEPT_FORMAT_TEXT:
+		default:
+			format_text_intercept_log_record(buf, record, false);
+			break;
 	}
 }
 
 /*
- * Adds a fixed prefix of the form "formatted_timestamp [PID]".
+ * Renders a record that a backend left for the writer process to format, see
+ * prepare_and_emit_intercept_log_message.  Returns the buffer the lines are
+ * formatted in.
  */
-static void
-add_prefix(StringInfo buf, ErrorData *edata)
+static StringInfo
+render_deferred_intercept_log_record(const char *data, int len)
 {
-	char formatted_log_time[FORMATTED_TS_LEN];
+	static MemoryContext render_context = NULL;
+	StringInfoData unit;
+	InterceptLogRecord record;
+	MemoryContext oldcontext;
 
-	MemSet(formatted_log_time, '\0', sizeof(formatted_log_time));
+	if (render_context == NULL)
+		render_context = AllocSetContextCreate(TopMemoryContext,
+											   "pg_intercept_server_logs render",
+											   ALLOCSET_DEFAULT_SIZES);
 
-	get_formatted_intercept_log_time(formatted_log_time);
+	/* Skip the unit length, the ring record has the length already. */
+	unit.data = (char *) data;
+	unit.len = len;
+	unit.maxlen = len;
+	unit.cursor = 5;
 
-	appendStringInfoString(buf, formatted_log_time);
+	Assert(len > 5 && data[4] == INTERCEPT_BINARY_INLINE_RECORD);
 
-	appendStringInfo(buf, " [%d] ", MyProcPid);
-}
+	oldcontext = MemoryContextSwitchTo(render_context);
+	decode_binary_intercept_log_record(&unit, NULL, &record);
 
-/*
- * Writes the provided line to stderr.
- */
-static void
-write_console(const char *line, int len)
-{
-	int			rc;
+	resetStringInfo(&intercept_format_buf);
+	format_decoded_intercept_log_record(&intercept_format_buf, &record,
+										log_format);
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(render_context);
 
-	/*
-	 * We ignore any error from write() here.  We have no useful way to report
-	 * it ... certainly whining on stderr isn't likely to be productive.
-	 */
-	rc = write(fileno(stderr), line, len);
-	(void) rc;
+	return &intercept_format_buf;
 }
 
 /*
- * Writes the provided line to intercept log file.
+ * Renders the records of a binary intercept log file in one of the other
+ * formats, one row per record.  This is where the formatting work that the
+ * binary format saves the backends is done, away from the error path.
+ *
+ * The file can be in the middle of being written to, so an incomplete unit
+ * at its end is taken to be the end of the file.
  */
-static void
-write_file(const char *line, int len, int elevel)
+Datum
+pg_intercept_server_logs_decode(PG_FUNCTION_ARGS)
 {
-	int		fd;
-	char	fullpath[MAXPGPATH * 2];
+	char	   *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	char	   *format_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	const struct config_enum_entry *entry;
+	MemoryContext oldcontext;
+	MemoryContext record_context;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	HASHCTL		ctl;
+	HTAB	   *strings;
+	FILE	   *file;
+	StringInfoData unit;
+	StringInfoData out;
+
+	for (entry = log_format_options; entry->name != NULL; entry++)
+	{
+		if (pg_strcasecmp(format_name, entry->name) == 0)
+			break;
+	}
 
-	snprintf(fullpath, sizeof(fullpath), "%s/%s.log", log_directory,
-			_(intercept_log_severity(elevel)));
+	if (entry->name == NULL || entry->val == INTERCEPT_FORMAT_BINARY)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized output format \"%s\"", format_name),
+				 errhint("Valid formats are \"text\", \"compact\", \"json\" and \"csv\".")));
 
-	fd = open(fullpath, O_WRONLY | O_CREAT | O_APPEND,
-			  pg_file_create_mode);
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) ||
+		(rsinfo->allowedModes & SFRM_Materialize) == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
 
-	if (fd < 0)
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTemplateTupleDesc(1);
+	TupleDescInitEntry(tupdesc, (AttrNumber) 1, "record", TEXTOID, -1, 0);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	MemoryContextSwitchTo(oldcontext);
+
+	file = AllocateFile(path, PG_BINARY_R);
+	if (file == NULL)
 		ereport(ERROR,
 				(errcode_for_file_access(),
-					errmsg("could not open intercept log file \"%s\": %m",
-						   fullpath)));
+				 errmsg("could not open file \"%s\" for reading: %m", path)));
+
+	ctl.keysize = sizeof(InterceptDecodedKey);
+	ctl.entrysize = sizeof(InterceptDecodedString);
+	ctl.hcxt = CurrentMemoryContext;
+	strings = hash_create("pg_intercept_server_logs decoded strings", 256,
+						  &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
 
-	if (write(fd, line, len) != len)
+	record_context = AllocSetContextCreate(CurrentMemoryContext,
+										   "pg_intercept_server_logs decode",
+										   ALLOCSET_DEFAULT_SIZES);
+	initStringInfo(&unit);
+	initStringInfo(&out);
+
+	for (;;)
 	{
-		/* if write didn't set errno, assume problem is no disk space */
-		if (errno == 0)
-			errno = ENOSPC;
+		unsigned char lenbuf[4];
+		uint32		len;
+		char		type;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (fread(lenbuf, 1, 4, file) != 4)
+			break;
+
+		len = lenbuf[0] | (lenbuf[1] << 8) | (lenbuf[2] << 16) |
+			((uint32) lenbuf[3] << 24);
+		if (len == 0 || len >= MaxAllocSize)
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("invalid record length %u in file \"%s\"",
+							len, path)));
+
+		resetStringInfo(&unit);
+		enlargeStringInfo(&unit, (int) len);
+		if (fread(unit.data, 1, len, file) != len)
+			break;
+		unit.len = (int) len;
+		unit.data[len] = '\0';
+		unit.cursor = 0;
+
+		type = unit.data[unit.cursor++];
+
+		if (type == INTERCEPT_BINARY_DEFINITION)
+		{
+			InterceptDecodedKey key;
+			InterceptDecodedString *string;
+			bool		found;
+
+			key.pid = (int) read_binary_varint(&unit);
+			key.id = (uint32) read_binary_varint(&unit);
+			string = (InterceptDecodedString *) hash_search(strings, &key,
+															HASH_ENTER,
+															&found);
+
+			string->str = pstrdup(unit.data + unit.cursor);
+		}
+		else if (type == INTERCEPT_BINARY_RECORD ||
+				 type == INTERCEPT_BINARY_INLINE_RECORD)
+		{
+			InterceptLogRecord record;
+			Datum		value;
+			bool		isnull = false;
 
+			oldcontext = MemoryContextSwitchTo(record_context);
+			decode_binary_intercept_log_record(&unit,
+											   type == INTERCEPT_BINARY_RECORD ?
+											   strings : NULL,
+											   &record);
+
+			resetStringInfo(&out);
+			format_decoded_intercept_log_record(&out, &record, entry->val);
+			MemoryContextSwitchTo(oldcontext);
+
+			/* Rows don't end with the newline that lines do. */
+			if (out.len > 0 && out.data[out.len - 1] == '\n')
+				out.len--;
+
+			value = PointerGetDatum(cstring_to_text_with_len(out.data, out.len));
+			tuplestore_putvalues(tupstore, tupdesc, &value, &isnull);
+			MemoryContextReset(record_context);
+		}
+
+		/* Skip units of types we don't know of. */
+	}
+
+	if (ferror(file))
 		ereport(ERROR,
 				(errcode_for_file_access(),
-					errmsg("could not write intercept log file \"%s\": %m",
-						   fullpath)));
-	}
+				 errmsg("could not read file \"%s\": %m", path)));
+
+	FreeFile(file);
+
+	return (Datum) 0;
 }
 
 /*
@@ -460,113 +6807,145 @@ write_file(const char *line, int len, int elevel)
 static void
 prepare_and_emit_intercept_log_message(ErrorData *edata)
 {
-	StringInfoData buf;
-
-	initStringInfo(&buf);
+	StringInfo	buf = &intercept_format_buf;
+	InterceptLogRecord record;
+	int			format = log_format;
+	bool		to_console = (strcmp(log_directory, "") == 0);
 
-	add_prefix(&buf, edata);
-	appendStringInfo(&buf, "%s:  ", _(intercept_log_severity(edata->elevel)));
+	build_intercept_log_record(&record, edata);
 
-	if (edata->sqlerrcode != 0)
-		appendStringInfo(&buf, "%s:  ", unpack_sql_state(edata->sqlerrcode));
+	resetStringInfo(buf);
 
-	if (edata->message)
-		append_with_tabs(&buf, edata->message);
-	else
-		append_with_tabs(&buf, _("missing error text"));
+	/*
+	 * Binary records have no business in the server's stderr, which may well
+	 * be the server log.  They go there as text, like on_write_failure does.
+	 */
+	if (to_console && format == INTERCEPT_FORMAT_BINARY)
+		format = INTERCEPT_FORMAT_TEXT;
 
-	if (edata->cursorpos > 0)
-		appendStringInfo(&buf, _(" at character %d"),
-						 edata->cursorpos);
-	else if (edata->internalpos > 0)
-		appendStringInfo(&buf, _(" at character %d"),
-						 edata->internalpos);
+	/*
+	 * With deferred_formatting, hand the raw record over to the writer
+	 * process to format, if the message is to go through it at all.  The
+	 * record's strings are copied as they are, which is all that's left for
+	 * us to do.
+	 */
+	if (deferred_formatting && format != INTERCEPT_FORMAT_BINARY &&
+		!to_console && edata->elevel < PANIC && use_intercept_ring())
+	{
+		flush_intercept_log_buffer(edata->elevel);
 
-	appendStringInfoChar(&buf, '\n');
+		format_binary_intercept_log_record(buf, &record, false);
+		if (insert_into_intercept_ring(buf->data, buf->len, edata->elevel,
+									   true))
+		{
+			size_intercept_format_buffer(buf->len);
+			return;
+		}
 
-	if (edata->detail_log)
-	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("DETAIL:  "));
-		append_with_tabs(&buf, edata->detail_log);
-		appendStringInfoChar(&buf, '\n');
-	}
-	else if (edata->detail)
-	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("DETAIL:  "));
-		append_with_tabs(&buf, edata->detail);
-		appendStringInfoChar(&buf, '\n');
+		/* No room in the ring, format it here after all. */
+		resetStringInfo(buf);
 	}
 
-	if (edata->hint)
-	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("HINT:  "));
-		append_with_tabs(&buf, edata->hint);
-		appendStringInfoChar(&buf, '\n');
-	}
+	if (format != INTERCEPT_FORMAT_BINARY)
+		format_intercept_log_time(record.formatted_log_time, &record.log_time);
 
-	if (edata->internalquery)
+	switch (format)
 	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("QUERY:  "));
-		append_with_tabs(&buf, edata->internalquery);
-		appendStringInfoChar(&buf, '\n');
+		case INTERCEPT_FORMAT_JSON:
+			format_json_intercept_log_record(buf, &record);
+			break;
+		case INTERCEPT_FORMAT_CSV:
+			format_csv_intercept_log_record(buf, &record);
+			break;
+		case INTERCEPT_FORMAT_BINARY:
+			format_binary_intercept_log_record(buf, &record, true);
+			break;
+		case INTERCEPT_FORMAT_COMPACT:
+			format_text_intercept_log_record(buf, &record, true);
+			break;
+		case INTERCEPT_FORMAT_TEXT:
+		default:
+			format_text_intercept_log_record(buf, &record, false);
+			break;
 	}
 
-	if (edata->context && !edata->hide_ctx)
-	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("CONTEXT:  "));
-		append_with_tabs(&buf, edata->context);
-		appendStringInfoChar(&buf, '\n');
-	}
+	/*
+	 * Check if the log_directory exists, if yes, just write the logs
+	 * to output file, otherwise write to console i.e. stderr.
+	 */
+	if (to_console)
+		write_console(buf->data, buf->len);
+	else
+		write_file(buf->data, buf->len, edata->elevel);
 
-	/* assume no newlines in funcname or filename... */
-	if (edata->funcname && edata->filename)
-	{
-		add_prefix(&buf, edata);
-		appendStringInfo(&buf, _("LOCATION:  %s, %s:%d\n"),
-						 edata->funcname, edata->filename,
-						 edata->lineno);
-	}
-	else if (edata->filename)
-	{
-		add_prefix(&buf, edata);
-		appendStringInfo(&buf, _("LOCATION:  %s:%d\n"),
-						 edata->filename, edata->lineno);
-	}
+	size_intercept_format_buffer(buf->len);
+}
+
+/*
+ * Starts a new intercept log file for each level right away, as
+ * pg_rotate_logfile() does for the server log.  Processes move on to the new
+ * files on their next write.
+ */
+Datum
+pg_intercept_server_logs_rotate(PG_FUNCTION_ARGS)
+{
+	int			slot;
+
+	if (intercept_shared == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_intercept_server_logs must be loaded via \"shared_preload_libraries\" to rotate intercept log files")));
+
+	for (slot = 0; slot < INTERCEPT_NUM_SLOTS; slot++)
+		(void) rotate_intercept_log_segment(slot,
+											pg_atomic_read_u64(&intercept_shared->segment_start[slot]));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Reports the module's counters.
+ */
+Datum
+pg_intercept_server_logs_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Datum		values[9];
+	bool		nulls[9] = {0};
+	int			last_errno;
+	TimestampTz last_failure_time;
+
+	if (intercept_shared == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("pg_intercept_server_logs must be loaded via \"shared_preload_libraries\" to report statistics")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	values[0] = Int64GetDatum((int64) pg_atomic_read_u64(&intercept_shared->ring_overflows));
+	values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&intercept_shared->dropped_bytes));
+	values[2] = BoolGetDatum(intercept_disk_full());
+	values[3] = Int64GetDatum((int64) pg_atomic_read_u64(&intercept_shared->removed_files));
+	values[4] = Int64GetDatum((int64) pg_atomic_read_u64(&intercept_shared->removed_bytes));
+	values[5] = Int64GetDatum((int64) pg_atomic_read_u64(&intercept_shared->write_failures));
+
+	last_errno = (int) pg_atomic_read_u32(&intercept_shared->last_errno);
+	last_failure_time = (TimestampTz)
+		pg_atomic_read_u64(&intercept_shared->last_failure_time);
 
-	if (edata->backtrace)
+	if (last_failure_time != 0)
 	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("BACKTRACE:  "));
-		append_with_tabs(&buf, edata->backtrace);
-		appendStringInfoChar(&buf, '\n');
+		values[6] = CStringGetTextDatum(strerror(last_errno));
+		values[7] = TimestampTzGetDatum(last_failure_time);
 	}
-
-	/*
-	 * Log the query, if exists, irrespective of whether user wants it or
-	 * hide_stmt is true unlike regular server logging facility which uses
-	 * check_log_of_query().
-	 */
-	if (debug_query_string != NULL)
+	else
 	{
-		add_prefix(&buf, edata);
-		appendStringInfoString(&buf, _("STATEMENT:  "));
-		append_with_tabs(&buf, debug_query_string);
-		appendStringInfoChar(&buf, '\n');
+		nulls[6] = true;
+		nulls[7] = true;
 	}
 
-	/*
-	 * Check if the log_directory exists, if yes, just write the logs
-	 * to output file, otherwise write to console i.e. stderr.
-	 */
-	if (strcmp(log_directory, "") == 0)
-		write_console(buf.data, buf.len);
-	else
-		write_file(buf.data, buf.len, edata->elevel);
+	values[8] = Int64GetDatum((int64) pg_atomic_read_u64(&intercept_shared->suppressed_messages));
 
-	pfree(buf.data);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
 }
@@ -0,0 +1,67 @@
+--
+-- binary log_format: the records written decode back into the other formats
+--
+CREATE EXTENSION pg_intercept_server_logs;
+LOAD 'pg_intercept_server_logs';
+
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set log_dir :abs_builddir '/results'
+
+SET client_min_messages = warning;
+SET pg_intercept_server_logs.override_log_min_messages = on;
+SET pg_intercept_server_logs.log_level = notice;
+SET pg_intercept_server_logs.log_format = binary;
+SET pg_intercept_server_logs.buffer_size = 0;
+SET pg_intercept_server_logs.log_directory = :'log_dir';
+
+-- NOTICE.bin keeps the records of the previous runs, those of this one are
+-- told apart by a random tag.
+SELECT md5(random()::text) AS tag \gset
+
+CREATE FUNCTION pg_temp.raise(message text, detail text, hint text)
+RETURNS void
+LANGUAGE plpgsql AS $$
+BEGIN
+    IF detail IS NULL THEN
+        RAISE NOTICE '%', message;
+    ELSE
+        RAISE NOTICE '%', message USING DETAIL = detail, HINT = hint;
+    END IF;
+END
+$$;
+
+CREATE FUNCTION pg_temp.decoded(tag text, format text) RETURNS SETOF text
+LANGUAGE sql AS $$
+    SELECT line
+    FROM pg_intercept_server_logs_decode(
+        current_setting('pg_intercept_server_logs.log_directory') || '/NOTICE.bin',
+        format) AS line
+    WHERE strpos(line, tag) > 0
+$$;
+
+-- Both messages are raised from the same place, the second one refers to the
+-- source location interned by the first one.
+SELECT pg_temp.raise('first ' || :'tag', E'two\nlines, "quoted"', 'a hint');
+SELECT pg_temp.raise('second ' || :'tag', NULL, NULL);
+
+SELECT count(*) AS records FROM pg_temp.decoded(:'tag', 'text');
+
+SELECT strpos(line, 'NOTICE:  first ' || :'tag') > 0 AS message,
+       strpos(line, E'DETAIL:  two\n\tlines, "quoted"') > 0 AS detail,
+       strpos(line, 'HINT:  a hint') > 0 AS hint
+FROM pg_temp.decoded('first ' || :'tag', 'text') AS line;
+
+SELECT j ->> 'error_severity' AS severity,
+       j ->> 'message' = 'first ' || :'tag' AS first,
+       j ->> 'detail' = E'two\nlines, "quoted"' AS detail,
+       j ->> 'hint' AS hint,
+       j ->> 'func_name' AS func_name,
+       j ->> 'file_name' AS file_name,
+       j ->> 'pid' = pg_backend_pid()::text AS pid,
+       j ->> 'dbname' = current_database() AS dbname
+FROM (SELECT line::json AS j FROM pg_temp.decoded(:'tag', 'json') AS line) s
+ORDER BY j ->> 'message';
+
+SELECT count(*) AS records FROM pg_temp.decoded(:'tag', 'csv');
+
+SELECT pg_intercept_server_logs_decode(:'log_dir' || '/NOTICE.bin', 'binary');
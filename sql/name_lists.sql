@@ -0,0 +1,92 @@
+--
+-- backend_types and application_names, whose names may contain spaces and be
+-- double-quoted
+--
+LOAD 'pg_intercept_server_logs';
+
+-- The messages are written into the results directory, each test reads back
+-- what it has just added to NOTICE.log there.
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set log_dir :abs_builddir '/results'
+
+SET client_min_messages = warning;
+SET pg_intercept_server_logs.override_log_min_messages = on;
+SET pg_intercept_server_logs.log_level = notice;
+SET pg_intercept_server_logs.log_format = text;
+SET pg_intercept_server_logs.buffer_size = 0;
+SET pg_intercept_server_logs.log_directory = :'log_dir';
+
+CREATE FUNCTION pg_temp.intercepted(message text) RETURNS boolean
+LANGUAGE plpgsql AS $$
+DECLARE
+    path text := current_setting('pg_intercept_server_logs.log_directory') ||
+        '/NOTICE.log';
+    size bigint := coalesce((pg_stat_file(path, true)).size, 0);
+BEGIN
+    RAISE NOTICE '%', message;
+    RETURN strpos(coalesce(pg_read_file(path, size, 1000000, true), ''),
+                  message) > 0;
+END
+$$;
+
+SELECT pg_temp.intercepted('no filter');
+
+-- backend_types
+SET pg_intercept_server_logs.backend_types = 'autovacuum worker, client backend';
+SELECT pg_temp.intercepted('client backend listed');
+SET pg_intercept_server_logs.backend_types = 'autovacuum worker,client backend ';
+SELECT pg_temp.intercepted('client backend listed, no spaces around');
+SET pg_intercept_server_logs.backend_types = ' "client backend" ';
+SELECT pg_temp.intercepted('client backend quoted');
+SET pg_intercept_server_logs.backend_types = 'autovacuum worker';
+SELECT pg_temp.intercepted('client backend not listed');
+SET pg_intercept_server_logs.backend_types = '!client backend';
+SELECT pg_temp.intercepted('client backend excluded');
+SET pg_intercept_server_logs.backend_types = '!autovacuum worker';
+SELECT pg_temp.intercepted('other backend type excluded');
+RESET pg_intercept_server_logs.backend_types;
+
+-- application_names
+SET pg_intercept_server_logs.application_names = 'my app, "other, app", " padded ", "say ""hi"""';
+SET application_name = 'my app';
+SELECT pg_temp.intercepted('application name with a space');
+SET application_name = 'other, app';
+SELECT pg_temp.intercepted('application name with a comma');
+SET application_name = ' padded ';
+SELECT pg_temp.intercepted('application name with spaces around');
+SET application_name = 'say "hi"';
+SELECT pg_temp.intercepted('application name with quotes');
+SET application_name = 'padded';
+SELECT pg_temp.intercepted('application name not listed');
+SET application_name = 'other';
+SELECT pg_temp.intercepted('application name not listed either');
+SET pg_intercept_server_logs.application_names = '!my app, !other';
+SELECT pg_temp.intercepted('application name excluded');
+SET application_name = 'my app';
+SELECT pg_temp.intercepted('application name with a space excluded');
+SET application_name = 'another app';
+SELECT pg_temp.intercepted('application name not excluded');
+RESET application_name;
+RESET pg_intercept_server_logs.application_names;
+
+-- invalid lists, the previous setting stays
+SET pg_intercept_server_logs.backend_types = 'client backend';
+SET pg_intercept_server_logs.application_names = '!my app';
+SET pg_intercept_server_logs.backend_types = 'client backend,';
+SET pg_intercept_server_logs.backend_types = ',client backend';
+SET pg_intercept_server_logs.backend_types = 'autovacuum worker,,client backend';
+SET pg_intercept_server_logs.backend_types = 'autovacuum worker, , client backend';
+SET pg_intercept_server_logs.backend_types = '"client backend';
+SET pg_intercept_server_logs.backend_types = '"client" backend';
+SET pg_intercept_server_logs.backend_types = '""';
+SET pg_intercept_server_logs.backend_types = '!';
+SET pg_intercept_server_logs.application_names = 'my app, !';
+SHOW pg_intercept_server_logs.backend_types;
+SHOW pg_intercept_server_logs.application_names;
+SELECT pg_temp.intercepted('after the invalid lists');
+RESET pg_intercept_server_logs.application_names;
+
+-- an empty list intercepts everything
+SET pg_intercept_server_logs.backend_types = '';
+SELECT pg_temp.intercepted('empty list');
+RESET pg_intercept_server_logs.backend_types;
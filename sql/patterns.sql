@@ -0,0 +1,69 @@
+--
+-- include_patterns and exclude_patterns, substrings and regular expressions
+--
+LOAD 'pg_intercept_server_logs';
+
+\getenv abs_builddir PG_ABS_BUILDDIR
+\set log_dir :abs_builddir '/results'
+
+SET client_min_messages = warning;
+SET pg_intercept_server_logs.override_log_min_messages = on;
+SET pg_intercept_server_logs.log_level = notice;
+SET pg_intercept_server_logs.log_format = text;
+SET pg_intercept_server_logs.buffer_size = 0;
+SET pg_intercept_server_logs.log_directory = :'log_dir';
+
+CREATE FUNCTION pg_temp.intercepted(message text) RETURNS boolean
+LANGUAGE plpgsql AS $$
+DECLARE
+    path text := current_setting('pg_intercept_server_logs.log_directory') ||
+        '/NOTICE.log';
+    size bigint := coalesce((pg_stat_file(path, true)).size, 0);
+BEGIN
+    RAISE NOTICE '%', message;
+    RETURN strpos(coalesce(pg_read_file(path, size, 1000000, true), ''),
+                  message) > 0;
+END
+$$;
+
+-- substrings, which may contain spaces
+SET pg_intercept_server_logs.include_patterns = 'lock timeout, checkpoint starting';
+SELECT pg_temp.intercepted('canceling statement due to lock timeout');
+SELECT pg_temp.intercepted('checkpoint starting: time');
+SELECT pg_temp.intercepted('checkpoint complete');
+SELECT pg_temp.intercepted('canceling statement due to Lock Timeout');
+SET pg_intercept_server_logs.include_patterns = '"a, b", " padded "';
+SELECT pg_temp.intercepted('x a, b y');
+SELECT pg_temp.intercepted('x padded y');
+SELECT pg_temp.intercepted('xpaddedy');
+
+-- regular expressions
+SET pg_intercept_server_logs.include_patterns = '/^checkpoint (starting|complete)/, /[0-9]+ rows? affected$/';
+SELECT pg_temp.intercepted('checkpoint complete: wrote 3 buffers');
+SELECT pg_temp.intercepted('the checkpoint starting');
+SELECT pg_temp.intercepted('12 rows affected');
+SELECT pg_temp.intercepted('12 rows affected!');
+SELECT pg_temp.intercepted(repeat('x', 2000) || ' 1 row affected');
+SELECT pg_temp.intercepted(repeat('x', 2000) || ' 1 row affected!');
+
+-- exclude_patterns win over include_patterns
+SET pg_intercept_server_logs.include_patterns = 'checkpoint';
+SET pg_intercept_server_logs.exclude_patterns = '/complete$/, checkpoint starting: immediate';
+SELECT pg_temp.intercepted('checkpoint complete');
+SELECT pg_temp.intercepted('checkpoint complete: wrote 3 buffers');
+SELECT pg_temp.intercepted('checkpoint starting: immediate force wait');
+SELECT pg_temp.intercepted('checkpoint starting: time');
+RESET pg_intercept_server_logs.exclude_patterns;
+
+-- invalid patterns, the previous setting stays
+SET pg_intercept_server_logs.include_patterns = '/(/';
+SET pg_intercept_server_logs.include_patterns = 'checkpoint, /[a/';
+SET pg_intercept_server_logs.include_patterns = 'lock timeout,,checkpoint';
+SET pg_intercept_server_logs.include_patterns = '"lock timeout';
+SET pg_intercept_server_logs.exclude_patterns = 'lock timeout, ';
+SHOW pg_intercept_server_logs.include_patterns;
+SHOW pg_intercept_server_logs.exclude_patterns;
+SELECT pg_temp.intercepted('checkpoint starting: time');
+SELECT pg_temp.intercepted('canceling statement due to lock timeout');
+RESET pg_intercept_server_logs.include_patterns;
+SELECT pg_temp.intercepted('canceling statement due to lock timeout');